@@ -0,0 +1,478 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include "teerank.h"
+#include "database.h"
+#include "server.h"
+#include "stats.h"
+#include "cgi.h"
+#include "json.h"
+
+/*
+ * Run every routes in-process, the way teerank.cgi does in SCGI mode,
+ * against the database at $TEERANK_DB (see teerank-generate).  For each
+ * URL, report latency percentiles, the number of SQL statements run
+ * and the size of the response.
+ *
+ * URLs taking an argument are run with a different sample each time,
+ * taken from the database so that every runs use the same samples.
+ */
+
+#define NSAMPLES 64
+#define SAMPLE_SIZE 128
+
+enum sample {
+	NONE,
+	PLAYER, PLAYER_HEX, HISTORIC, CLAN, CLAN_HEX, SERVER,
+	PLAYER_PAGE, CLAN_PAGE, SERVER_PAGE,
+	PLAYER_SEARCH, SERVER_SEARCH,
+	NR_SAMPLES
+};
+
+static char samples[NR_SAMPLES][NSAMPLES][SAMPLE_SIZE];
+static unsigned nsamples[NR_SAMPLES];
+
+/* Every routes in "routes.def", deprecated URLs being redirections */
+static const struct url {
+	const char *fmt;
+	enum sample sample;
+} URLS[] = {
+	{ "/", NONE },
+	{ "/players?p=%s", PLAYER_PAGE },
+	{ "/players/by-lastseen?p=%s", PLAYER_PAGE },
+	{ "/players/by-rank.json?p=%s", PLAYER_PAGE },
+	{ "/players/by-lastseen.json?p=%s", PLAYER_PAGE },
+	{ "/player/%s", PLAYER },
+	{ "/players/%s.json", PLAYER_HEX },
+	{ "/players/%s.json?short", PLAYER_HEX },
+	{ "/player/%s/historic.svg", HISTORIC },
+	{ "/player/%s/historic.svg?range=day", HISTORIC },
+	{ "/player/%s/historic.svg?range=month", HISTORIC },
+	{ "/player/%s/historic.svg?range=all", HISTORIC },
+	{ "/clans?p=%s", CLAN_PAGE },
+	{ "/clans/by-nmembers.json?p=%s", CLAN_PAGE },
+	{ "/clan/%s", CLAN },
+	{ "/clans/%s.json", CLAN_HEX },
+	{ "/servers?p=%s", SERVER_PAGE },
+	{ "/servers/by-nplayers.json?p=%s", SERVER_PAGE },
+	{ "/server/%s", SERVER },
+	{ "/servers/%s.json", SERVER },
+	{ "/search?q=%s", PLAYER_SEARCH },
+	{ "/players/search?q=%s", PLAYER_SEARCH },
+	{ "/clans/search?q=%s", PLAYER_SEARCH },
+	{ "/servers/search?q=%s", SERVER_SEARCH },
+	{ "/about", NONE },
+	{ "/about.json", NONE },
+	{ "/about-json-api", NONE },
+	{ "/status", NONE },
+	{ "/robots.txt", NONE },
+	{ "/sitemap.xml", NONE },
+#if ROUTE_V2_URLS
+	{ "/pages/%s.html", PLAYER_PAGE },
+#endif
+#if ROUTE_V3_URLS
+	{ "/players/%s.html", PLAYER_HEX },
+	{ "/players/%s/elo+rank.svg", PLAYER_HEX },
+	{ "/clans/%s.html", CLAN_HEX },
+	{ "/servers/%s.html", SERVER },
+#endif
+	{ NULL }
+};
+
+static void add_sample(enum sample sample, const char *str)
+{
+	if (nsamples[sample] < NSAMPLES)
+		snprintf(samples[sample][nsamples[sample]++], SAMPLE_SIZE, "%s", str);
+}
+
+static void read_name(sqlite3_stmt *res, void *name)
+{
+	snprintf(name, SAMPLE_SIZE, "%s", sqlite3_column_text(res, 0));
+}
+
+/*
+ * Evenly spread samples, so that they don't depend on rows order.
+ * Names can be sampled as is, in hexadecimal, and their first few
+ * characters as search terms.
+ */
+static void load_name_samples(
+	const char *query, enum sample sample, enum sample hex, enum sample search)
+{
+	sqlite3_stmt *res;
+	unsigned nrow;
+	char name[SAMPLE_SIZE];
+
+	foreach_row(query, read_name, name, "u", NSAMPLES) {
+		add_sample(sample, url_encode(name));
+		if (hex != NONE)
+			add_sample(hex, json_hexstring(name));
+		if (search != NONE) {
+			name[3] = '\0';
+			add_sample(search, url_encode(name));
+		}
+	}
+}
+
+static void load_server_samples(void)
+{
+	struct server sv;
+	sqlite3_stmt *res;
+	unsigned nrow;
+	char search[6];
+
+	const char *query =
+		"SELECT" ALL_SERVER_COLUMNS
+		" FROM servers"
+		" WHERE rowid % (SELECT MAX(rowid) / ?1 + 1 FROM servers) = 0"
+		" LIMIT ?1";
+
+	foreach_server(query, &sv, "u", NSAMPLES) {
+		add_sample(SERVER, build_addr(sv.ip, sv.port));
+
+		/* Take a few characters in the middle of the name */
+		snprintf(search, sizeof(search), "%s", sv.name + strlen(sv.name) / 2);
+		add_sample(SERVER_SEARCH, url_encode(search));
+	}
+}
+
+static void load_page_samples(enum sample sample, unsigned nrows)
+{
+	unsigned i, npages = nrows / 100 + 1;
+	char pnum[16];
+
+	for (i = 0; i < NSAMPLES && i < npages; i++) {
+		snprintf(pnum, sizeof(pnum), "%u", 1 + i * npages / NSAMPLES);
+		add_sample(sample, pnum);
+	}
+}
+
+static void load_samples(void)
+{
+	struct stats stats;
+
+	load_name_samples(
+		"SELECT name FROM players"
+		" WHERE rowid % (SELECT MAX(rowid) / ?1 + 1 FROM players) = 0"
+		" LIMIT ?1", PLAYER, PLAYER_HEX, PLAYER_SEARCH);
+	load_name_samples(
+		"SELECT DISTINCT name FROM player_historic LIMIT ?",
+		HISTORIC, NONE, NONE);
+	load_name_samples(
+		"SELECT name FROM clans"
+		" WHERE rowid % (SELECT MAX(rowid) / ?1 + 1 FROM clans) = 0"
+		" LIMIT ?1", CLAN, CLAN_HEX, NONE);
+	load_server_samples();
+
+	if (!read_stats(&stats)) {
+		fprintf(stderr, "%s: Couldn't read stats\n", config.dbpath);
+		exit(EXIT_FAILURE);
+	}
+
+	load_page_samples(PLAYER_PAGE, stats.nplayers);
+	load_page_samples(CLAN_PAGE, stats.nclans);
+	load_page_samples(SERVER_PAGE, stats.nservers);
+}
+
+/* Triggers programs are traced as well, they start with "--" */
+static unsigned nstatements;
+
+static int count_statement(unsigned type, void *ctx, void *p, void *x)
+{
+	const char *sql = x;
+
+	if (sql && strncmp(sql, "--", 2) != 0)
+		nstatements++;
+	return 0;
+}
+
+static double elapsed_ms(struct timespec *start)
+{
+	struct timespec end;
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	return (end.tv_sec - start->tv_sec) * 1000.0
+		+ (end.tv_nsec - start->tv_nsec) / 1000000.0;
+}
+
+static int cmp_double(const void *_a, const void *_b)
+{
+	const double *a = _a, *b = _b;
+	return (*a > *b) - (*a < *b);
+}
+
+static double percentile(double *values, unsigned n, unsigned p)
+{
+	unsigned i = (n * p + 99) / 100;
+	return values[i ? i - 1 : 0];
+}
+
+/*
+ * Responses are written to a temporary file in append mode, truncated
+ * after each request to get its size.
+ */
+static int response;
+
+static int is_error(void)
+{
+	char buf[64];
+	ssize_t ret;
+
+	if ((ret = pread(response, buf, sizeof(buf) - 1, 0)) <= 0)
+		return 1;
+	buf[ret] = '\0';
+
+	/* Redirections are expected from deprecated URLs */
+	return strstr(buf, "Status: ") && !strstr(buf, "Status: 301");
+}
+
+struct result {
+	unsigned n;
+	unsigned nerrors;
+	double statements;
+	double bytes;
+};
+
+static void serve(const char *uri)
+{
+	setenv("REQUEST_URI", uri, 1);
+	serve_request();
+	fflush(stdout);
+}
+
+static void run(const char *uri, double *latency, struct result *result)
+{
+	struct timespec start;
+	struct stat st;
+
+	nstatements = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	serve(uri);
+	*latency = elapsed_ms(&start);
+
+	fstat(response, &st);
+	if (is_error())
+		result->nerrors++;
+
+	result->n++;
+	result->statements += nstatements;
+	result->bytes += st.st_size;
+
+	if (ftruncate(response, 0) == -1)
+		perror("ftruncate()");
+}
+
+static void make_uri(char *uri, const char *fmt, enum sample sample, unsigned i)
+{
+	if (sample == NONE)
+		snprintf(uri, 1024, "%s", fmt);
+	else
+		snprintf(uri, 1024, fmt, samples[sample][i % nsamples[sample]]);
+}
+
+static void bench(FILE *report, const char *fmt, enum sample sample, unsigned n, double *latency)
+{
+	struct result result = { 0 };
+	char uri[1024], label[256];
+	unsigned i, nwarmup;
+
+	if (sample == NONE)
+		snprintf(label, sizeof(label), "%s", fmt);
+	else
+		snprintf(label, sizeof(label), fmt, "*");
+
+	if (sample != NONE && !nsamples[sample]) {
+		fprintf(report, "%-36s (no samples)\n", label);
+		return;
+	}
+
+	/* Warm up with each sample once, results are discarded */
+	nwarmup = sample == NONE ? 1 : nsamples[sample];
+	for (i = 0; i < nwarmup; i++) {
+		make_uri(uri, fmt, sample, i);
+		run(uri, &latency[0], &result);
+	}
+
+	memset(&result, 0, sizeof(result));
+	for (i = 0; i < n; i++) {
+		make_uri(uri, fmt, sample, i);
+		run(uri, &latency[i], &result);
+	}
+
+	qsort(latency, n, sizeof(*latency), cmp_double);
+
+	fprintf(report, "%-36s %5u %9.3f %9.3f %9.3f %8.1f %10.0f %6u\n",
+	        label, n,
+	        percentile(latency, n, 50),
+	        percentile(latency, n, 95),
+	        percentile(latency, n, 99),
+	        result.statements / n, result.bytes / n, result.nerrors);
+	fflush(report);
+}
+
+/*
+ * SCGI workers serve many requests, so a page failing half way must not
+ * change the next ones.  Those pages fail after they started to output
+ * HTML.
+ */
+static const char *FAILING_URLS[] = {
+	"/players?p=99999999",
+	"/clans?p=99999999",
+	"/servers?p=99999999",
+	"/player/00",
+	NULL
+};
+
+/* Response body, headers are skipped because of Server-Timing */
+static char *read_body(size_t *size)
+{
+	struct stat st;
+	char *buf, *body;
+	ssize_t ret;
+
+	fstat(response, &st);
+	if (!(buf = malloc(st.st_size + 1)))
+		return NULL;
+
+	ret = pread(response, buf, st.st_size, 0);
+	buf[ret > 0 ? ret : 0] = '\0';
+
+	body = strstr(buf, "\n\n");
+	body = body ? body + 2 : buf;
+	*size = strlen(body);
+	memmove(buf, body, *size + 1);
+
+	if (ftruncate(response, 0) == -1)
+		perror("ftruncate()");
+
+	return buf;
+}
+
+/* Serve the URL before and after failing pages, both must be the same */
+static int check(FILE *report, const char *fmt, enum sample sample)
+{
+	const char **failing;
+	char uri[1024], *before, *after;
+	size_t nbefore, nafter;
+	int ok;
+
+	if (sample != NONE && !nsamples[sample])
+		return 1;
+
+	make_uri(uri, fmt, sample, 0);
+
+	serve(uri);
+	before = read_body(&nbefore);
+
+	for (failing = FAILING_URLS; *failing; failing++) {
+		serve(*failing);
+		free(read_body(&nafter));
+	}
+
+	serve(uri);
+	after = read_body(&nafter);
+
+	ok = before && after && nbefore == nafter && memcmp(before, after, nbefore) == 0;
+	fprintf(report, "%-36s %s\n", uri, ok ? "ok" : "FAILED");
+	fflush(report);
+
+	free(before);
+	free(after);
+	return ok;
+}
+
+static int redirect_stdout(void)
+{
+	char path[] = "/tmp/teerank-bench-XXXXXX";
+	int fd;
+
+	if ((fd = mkstemp(path)) == -1) {
+		perror(path);
+		return -1;
+	}
+	unlink(path);
+
+	if (fcntl(fd, F_SETFL, O_APPEND) == -1 || dup2(fd, STDOUT_FILENO) == -1) {
+		perror(path);
+		return -1;
+	}
+
+	return fd;
+}
+
+static void usage(const char *bin)
+{
+	fprintf(stderr, "usage: %s [-c] [-n iterations] [url...]\n", bin);
+	fprintf(stderr, "Benchmark every routes, or the given URLs, using $TEERANK_DB.  With -c,\n");
+	fprintf(stderr, "check instead that pages failing half way don't change the next ones.\n");
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv)
+{
+	const struct url *url;
+	unsigned n = 100;
+	double *latency;
+	FILE *report;
+	int c, i, checking = 0, ok = 1;
+
+	while ((c = getopt(argc, argv, "cn:")) != -1) {
+		if (c == 'c')
+			checking = 1;
+		else if (c != 'n' || !(n = strtoul(optarg, NULL, 10)))
+			usage(argv[0]);
+	}
+
+	init_teerank(1);
+
+	/* Every requests must run routes, as teerank.cgi would in CGI mode */
+	config.cache = "";
+	config.scgi = "";
+
+	load_samples();
+	sqlite3_trace_v2(db, SQLITE_TRACE_STMT, count_statement, NULL);
+
+	if (!(latency = calloc(n, sizeof(*latency)))) {
+		perror("calloc()");
+		return EXIT_FAILURE;
+	}
+
+	if (!(report = fdopen(dup(STDOUT_FILENO), "w"))) {
+		perror("fdopen()");
+		return EXIT_FAILURE;
+	}
+	if ((response = redirect_stdout()) == -1)
+		return EXIT_FAILURE;
+
+	if (checking) {
+		if (optind < argc) {
+			for (i = optind; i < argc; i++)
+				ok &= check(report, argv[i], NONE);
+		} else {
+			for (url = URLS; url->fmt; url++)
+				ok &= check(report, url->fmt, url->sample);
+		}
+
+		return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+
+	fprintf(report, "%-36s %5s %9s %9s %9s %8s %10s %6s\n",
+	        "url", "n", "p50 (ms)", "p95 (ms)", "p99 (ms)",
+	        "queries", "bytes", "errors");
+
+	if (optind < argc) {
+		for (i = optind; i < argc; i++)
+			bench(report, argv[i], NONE, n, latency);
+	} else {
+		for (url = URLS; url->fmt; url++)
+			bench(report, url->fmt, url->sample, n, latency);
+	}
+
+	free(latency);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,461 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "teerank.h"
+#include "database.h"
+#include "player.h"
+#include "clan.h"
+#include "server.h"
+#include "master.h"
+#include "stats.h"
+
+/*
+ * Build a synthetic database, big enough to tell how pages behave with
+ * a real-world load.  Base tables are written using the schema from
+ * create_database(), then derived tables are created from them, just
+ * like when teerank-update runs on a database missing them.
+ *
+ * Everything is generated from the seed, hence two databases generated
+ * with the same parameters are the same, save for timestamps.
+ */
+
+static struct params {
+	unsigned nplayers;
+	unsigned nclans;
+	unsigned nservers;
+	unsigned ndays;
+	unsigned nhistoric;
+	unsigned interval;
+	unsigned seed;
+} params = {
+	10000, 0, 0, 365, 100, 60, 1
+};
+
+static time_t now;
+static struct master master;
+
+/* Integer hash, so that the nth name is known without storing it */
+static unsigned mix(unsigned x)
+{
+	x ^= params.seed * 0x9e3779b9u;
+	x ^= x >> 16;
+	x *= 0x7feb352du;
+	x ^= x >> 15;
+	x *= 0x846ca68bu;
+	x ^= x >> 16;
+	return x;
+}
+
+/* Xorshift, rand() is not the same everywhere */
+static unsigned rnd(void)
+{
+	static unsigned state;
+
+	if (!state)
+		state = mix(0) | 1;
+
+	state ^= state << 13;
+	state ^= state >> 17;
+	state ^= state << 5;
+	return state;
+}
+
+/* Uniform number in [0, n) */
+static unsigned rnd_below(unsigned n)
+{
+	return n ? rnd() % n : 0;
+}
+
+/*
+ * Names are made of syllables followed by their number.  Since
+ * syllables have no digits, names are unique.  Some syllables need to
+ * be escaped in HTML, JSON or URLs.
+ */
+static void make_name(char *buf, unsigned h, const char *prefix, unsigned n)
+{
+	static const char *SYLLABLES[] = {
+		"tee", "name", "less", "ka", "ro", "zu", "mi", "xx",
+		"dark", "pro", "noob", "br", "ain", "sky", " ", "_",
+		".", "<3", "&", "\"", "%", "#", "mo", "ya"
+	};
+	const unsigned NSYLLABLES = sizeof(SYLLABLES) / sizeof(*SYLLABLES);
+	char syllables[NAME_LENGTH] = "";
+	unsigned i, count = 1 + h % 3;
+
+	/* Most names don't need escaping */
+	for (i = 0; i < count; i++) {
+		h = mix(h);
+		strcat(syllables, SYLLABLES[h % (h % 8 ? 14 : NSYLLABLES)]);
+	}
+
+	snprintf(buf, NAME_LENGTH, "%.*s%s%u", 9, syllables, prefix, n);
+}
+
+static void player_name(char *buf, unsigned i)
+{
+	make_name(buf, mix(2 * i), "", i);
+}
+
+/*
+ * Some players have no clan, and clans size is skewed: there are a lot
+ * of small clans and a few big ones.
+ */
+static void player_clan(char *buf, unsigned i)
+{
+	unsigned h = mix(2 * i + 1), c;
+	double u;
+
+	if (!params.nclans || h % 5 < 2) {
+		buf[0] = '\0';
+		return;
+	}
+
+	u = (double)(h >> 8) / (1u << 24);
+	c = params.nclans * u * u;
+	make_name(buf, mix(~c), "", c);
+}
+
+static void server_ip(char *buf, unsigned i)
+{
+	snprintf(buf, IP_STRSIZE, "10.%u.%u.%u",
+	         (i >> 16) & 0xff, (i >> 8) & 0xff, i & 0xff);
+}
+
+static void make_server(struct server *sv, unsigned i)
+{
+	static const char *GAMETYPES[] = { "DM", "TDM", "gores", "zCatch", "iDDRace" };
+	static const char *MAPS[] = { "dm1", "dm2", "ctf5", "run_blue", "Kobra 4" };
+
+	memset(sv, 0, sizeof(*sv));
+
+	server_ip(sv->ip, i);
+	snprintf(sv->port, sizeof(sv->port), "%u", 8303 + i % 16);
+
+	/* Most servers are vanilla CTF */
+	if (i % 10 < 7) {
+		snprintf(sv->name, sizeof(sv->name), "Teeworlds CTF #%u", i);
+		strcpy(sv->gametype, "CTF");
+		snprintf(sv->map, sizeof(sv->map), "ctf%u", 1 + i % 7);
+		sv->max_clients = i % 3 ? 16 : 8;
+	} else {
+		snprintf(sv->name, sizeof(sv->name), "%s server <%u>",
+		         GAMETYPES[i % 5], i);
+		snprintf(sv->gametype, sizeof(sv->gametype), "%s", GAMETYPES[i % 5]);
+		strcpy(sv->map, MAPS[(i / 10) % 5]);
+		sv->max_clients = 16;
+	}
+
+	sv->lastseen = now;
+	sv->expire = now + 300 + rnd_below(300);
+	strcpy(sv->master_node, master.node);
+	strcpy(sv->master_service, master.service);
+}
+
+/*
+ * Servers are written with their clients, and the first players are
+ * the ones playing right now.  Return the number of players online,
+ * "online" being filled with their server.
+ */
+static unsigned generate_servers(unsigned *online)
+{
+	struct server sv;
+	unsigned i, j, nonline = 0;
+	char name[NAME_LENGTH], clan[NAME_LENGTH];
+
+	const char *query =
+		"INSERT INTO server_clients(ip, port," ALL_SERVER_CLIENT_COLUMNS ")"
+		" VALUES (?, ?, ?, ?, ?, ?)";
+
+	for (i = 0; i < params.nservers; i++) {
+		unsigned nclients = 0;
+
+		make_server(&sv, i);
+		if (!write_server(&sv))
+			return 0;
+
+		/* A third of servers are empty, the others are quite full */
+		if (i % 3)
+			nclients = 1 + rnd_below(sv.max_clients);
+
+		for (j = 0; j < nclients && nonline < params.nplayers; j++) {
+			player_name(name, nonline);
+			player_clan(clan, nonline);
+			online[nonline++] = i;
+
+			if (!exec(query, "ssssii", sv.ip, sv.port, name, clan,
+			          (int)rnd_below(50), j % 5 != 0))
+				return 0;
+		}
+
+		if (!exec("UPDATE servers SET num_clients = ?"
+		          " WHERE ip = ? AND port = ?",
+		          "uss", j, sv.ip, sv.port))
+			return 0;
+	}
+
+	if (!exec("UPDATE masters SET nservers ="
+	          " (SELECT COUNT(1) FROM servers"
+	          "  WHERE master_node = node AND master_service = service)"))
+		return 0;
+
+	return nonline;
+}
+
+/* Roughly normal, around DEFAULT_ELO */
+static int random_elo(void)
+{
+	return DEFAULT_ELO - 300 + rnd_below(200) + rnd_below(200) + rnd_below(200);
+}
+
+/*
+ * Players have a placeholder rank, actual ranks are computed once
+ * every players are written.  A few players are not ranked yet.
+ */
+static int generate_players(unsigned *online, unsigned nonline)
+{
+	struct player p;
+	struct server sv;
+	unsigned i, period = params.ndays * 86400;
+
+	for (i = 0; i < params.nplayers; i++) {
+		player_name(p.name, i);
+		player_clan(p.clan, i);
+
+		if (rnd_below(10)) {
+			p.elo = random_elo();
+			p.rank = 1;
+		} else {
+			p.elo = DEFAULT_ELO;
+			p.rank = UNRANKED;
+		}
+
+		/* Offline players keep the last server they were seen on */
+		if (i < nonline) {
+			p.lastseen = now;
+			make_server(&sv, online[i]);
+		} else {
+			double u = (double)rnd_below(1 << 24) / (1 << 24);
+			p.lastseen = now - 60 - (time_t)(period * u * u);
+			make_server(&sv, rnd_below(params.nservers));
+		}
+
+		strcpy(p.server_ip, params.nservers ? sv.ip : "");
+		strcpy(p.server_port, params.nservers ? sv.port : "");
+
+		if (write_player(&p) != SUCCESS)
+			return 0;
+	}
+
+	return 1;
+}
+
+static int compute_ranks(void)
+{
+	const char *query =
+		"UPDATE players"
+		" SET rank = ranked.rank"
+		" FROM (SELECT name, ROW_NUMBER() OVER (ORDER BY" SORT_BY_ELO ") AS rank"
+		"       FROM players"
+		"       WHERE" IS_PLAYER_RANKED ") AS ranked"
+		" WHERE players.name = ranked.name";
+
+	return exec(query);
+}
+
+/*
+ * Historic is a random walk going back in time from the current elo
+ * and rank, one record per interval for the given number of days.
+ */
+static int generate_historic(void)
+{
+	struct player p;
+	sqlite3_stmt *res;
+	unsigned nrow, i, step = params.interval * 60;
+	char name[NAME_LENGTH];
+	time_t t, start = now - params.ndays * 86400;
+	int elo;
+	long rank;
+
+	const char *select =
+		"SELECT" ALL_PLAYER_COLUMNS
+		" FROM players"
+		" WHERE name = ?";
+
+	const char *insert =
+		"INSERT INTO player_historic(name," ALL_PLAYER_RECORD_COLUMNS ")"
+		" VALUES (?, ?, ?, ?)";
+
+	for (i = 0; i < params.nhistoric && i < params.nplayers; i++) {
+		player_name(name, i);
+		foreach_player(select, &p, "s", name);
+		if (!res || !nrow)
+			return 0;
+
+		if (p.rank == UNRANKED)
+			continue;
+
+		elo = p.elo;
+		rank = p.rank;
+		for (t = p.lastseen - p.lastseen % step; t >= start; t -= step) {
+			if (!exec(insert, "stiu", name, t, elo, (unsigned)rank))
+				return 0;
+
+			elo += (int)rnd_below(21) - 10;
+			rank += (long)rnd_below(2 * rank / 100 + 3) - (rank / 100 + 1);
+			if (rank < 1)
+				rank = 1;
+		}
+	}
+
+	return 1;
+}
+
+static void read_first_master(void)
+{
+	sqlite3_stmt *res;
+	unsigned nrow;
+
+	const char *query =
+		"SELECT" ALL_MASTER_COLUMNS
+		" FROM masters"
+		" ORDER BY node"
+		" LIMIT 1";
+
+	foreach_master(query, &master);
+	if (!res || !nrow) {
+		fprintf(stderr, "%s: No master server\n", config.dbpath);
+		exit(EXIT_FAILURE);
+	}
+}
+
+static int generate(void)
+{
+	unsigned *online, nonline = 0;
+
+	if (!(online = calloc(params.nplayers + 1, sizeof(*online)))) {
+		perror("calloc()");
+		return 0;
+	}
+
+	if (!exec("BEGIN"))
+		return 0;
+
+	drop_all_indices();
+
+	read_first_master();
+
+	verbose("Generating %u servers", params.nservers);
+	if (params.nservers && !(nonline = generate_servers(online)))
+		goto fail;
+
+	verbose("Generating %u players, %u online", params.nplayers, nonline);
+	if (!generate_players(online, nonline))
+		goto fail;
+
+	verbose("Computing ranks");
+	if (!compute_ranks())
+		goto fail;
+
+	create_all_indices();
+
+	verbose("Generating historic of %u players", params.nhistoric);
+	if (!generate_historic())
+		goto fail;
+
+	if (!exec("COMMIT"))
+		goto fail;
+
+	free(online);
+
+	verbose("Creating derived tables");
+	if (!create_derived_tables())
+		return 0;
+
+	return update_ranks_stats(params.nplayers, 0);
+
+fail:
+	free(online);
+	exec("ROLLBACK");
+	return 0;
+}
+
+static void usage(const char *bin)
+{
+	fprintf(stderr, "usage: %s [-p players] [-c clans] [-s servers] [-d days] [-a players_with_historic] [-i interval] [-S seed]\n", bin);
+	fprintf(stderr, "Create a synthetic database at $TEERANK_DB, which must not exist.\n");
+	fprintf(stderr, "Historic has one record every <interval> minutes for <days> days.\n");
+	exit(EXIT_FAILURE);
+}
+
+static unsigned parse_unsigned(const char *bin, const char *str)
+{
+	char *end;
+	unsigned long n = strtoul(str, &end, 10);
+
+	if (!*str || *end)
+		usage(bin);
+
+	return n;
+}
+
+int main(int argc, char **argv)
+{
+	struct stat st;
+	int c;
+
+	while ((c = getopt(argc, argv, "p:c:s:d:a:i:S:")) != -1) {
+		switch (c) {
+		case 'p': params.nplayers = parse_unsigned(argv[0], optarg); break;
+		case 'c': params.nclans = parse_unsigned(argv[0], optarg); break;
+		case 's': params.nservers = parse_unsigned(argv[0], optarg); break;
+		case 'd': params.ndays = parse_unsigned(argv[0], optarg); break;
+		case 'a': params.nhistoric = parse_unsigned(argv[0], optarg); break;
+		case 'i': params.interval = parse_unsigned(argv[0], optarg); break;
+		case 'S': params.seed = parse_unsigned(argv[0], optarg); break;
+		default: usage(argv[0]);
+		}
+	}
+
+	if (optind != argc || !params.interval)
+		usage(argv[0]);
+
+	/* Defaults scale with the number of players */
+	if (!params.nclans)
+		params.nclans = params.nplayers / 20;
+	if (!params.nservers)
+		params.nservers = params.nplayers / 20 + 1;
+
+	/*
+	 * Generating in an existing database would mix real data with
+	 * synthetic data, and init_teerank() would create derived tables
+	 * before base tables are filled, which is slower.
+	 */
+	load_config();
+	if (stat(config.dbpath, &st) == 0) {
+		fprintf(stderr, "%s: Database already exists\n", config.dbpath);
+		return EXIT_FAILURE;
+	}
+
+	setenv("TZ", "", 1);
+	tzset();
+
+	if (!init_database(0))
+		return EXIT_FAILURE;
+
+	now = time(NULL);
+
+	if (!generate()) {
+		fprintf(stderr, "%s: Couldn't generate database\n", config.dbpath);
+		return EXIT_FAILURE;
+	}
+
+	printf("%s: %u players, %u clans, %u servers, %u days of historic for %u players, in %lds\n",
+	       config.dbpath, params.nplayers, count_clans(), params.nservers,
+	       params.ndays, params.nhistoric, (long)(time(NULL) - now));
+
+	return EXIT_SUCCESS;
+}
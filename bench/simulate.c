@@ -0,0 +1,750 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "teerank.h"
+#include "database.h"
+#include "server.h"
+#include "master.h"
+
+/*
+ * Simulate a master server and the game servers it lists, on localhost,
+ * to load test teerank-update.  Each server has its own UDP port, right
+ * after the master one, and answers "gie3" requests with "inf3"
+ * packets.  Players leave and join servers between two requests, and
+ * requests can be delayed or lost.
+ *
+ * By default, it also runs teerank-update against the simulated master
+ * on a new database, and report how long it took to poll every servers
+ * and how much was written.  Each round restarts teerank-update with
+ * every servers expired, hence the first round creates players and the
+ * next ones update them.
+ */
+
+static struct params {
+	unsigned nservers;
+	unsigned nplayers;
+	unsigned churn;
+	unsigned loss;
+	unsigned latency;
+	unsigned timeout;
+	unsigned nrounds;
+	unsigned port;
+	const char *update;
+	int serve_only;
+} params = {
+	1000, 0, 10, 0, 0, 60, 1, 18300, "./teerank-update", 0
+};
+
+/* From update/packet.h, connless packets have a six bytes header */
+#define PACKET_SIZE 1400
+#define HEADER_SIZE 6
+
+/* Same value than teeworlds masters */
+#define SERVERS_PER_LIST 75
+
+/* Once every servers answered, let teerank-update flush its writes */
+#define GRACE_DELAY 2000
+
+/* Consider the sweep over when nothing was requested for that long */
+#define IDLE_DELAY 3000
+
+static const uint8_t MSG_GETINFO[] = { 255, 255, 255, 255, 'g', 'i', 'e', '3' };
+static const uint8_t MSG_GETLIST[] = { 255, 255, 255, 255, 'r', 'e', 'q', '2' };
+static const uint8_t MSG_INFO[]    = { 255, 255, 255, 255, 'i', 'n', 'f', '3' };
+static const uint8_t MSG_LIST[]    = { 255, 255, 255, 255, 'l', 'i', 's', '2' };
+
+static struct sim_server {
+	unsigned max_clients;
+	unsigned nclients;
+	unsigned clients[MAX_CLIENTS];
+	int scores[MAX_CLIENTS];
+
+	/* Reset every round */
+	unsigned nrequests;
+	int answered;
+} *servers;
+
+/* Master socket first, then servers ones */
+static struct pollfd *fds;
+
+static struct round {
+	unsigned long start;
+	unsigned long last_request;
+	unsigned long last_answer;
+
+	unsigned nrequests;
+	unsigned nmaster_requests;
+	unsigned nrequested;
+	unsigned nanswered;
+	unsigned ndropped;
+} round;
+
+static int stop;
+static void stop_gracefully(int sig)
+{
+	stop = 1;
+}
+
+/* Monotonic time in milliseconds, see update/pool.c */
+static unsigned long now(void)
+{
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) == -1)
+		return 0;
+
+	return ts.tv_sec * 1000UL + ts.tv_nsec / 1000000;
+}
+
+/* Xorshift, see bench/generate.c */
+static unsigned rnd(void)
+{
+	static unsigned state = 2463534242u;
+
+	state ^= state << 13;
+	state ^= state >> 17;
+	state ^= state << 5;
+	return state;
+}
+
+static unsigned rnd_below(unsigned n)
+{
+	return n ? rnd() % n : 0;
+}
+
+/*
+ * Answers are sent once their delay expired, they are kept in a binary
+ * heap ordered by due date.
+ */
+struct answer {
+	unsigned long due;
+	int fd;
+	struct sockaddr_storage addr;
+	socklen_t addrlen;
+	size_t size;
+	uint8_t data[PACKET_SIZE];
+};
+
+static struct answer **heap;
+static unsigned heap_size, heap_capacity;
+
+static void heap_swap(unsigned a, unsigned b)
+{
+	struct answer *tmp = heap[a];
+	heap[a] = heap[b];
+	heap[b] = tmp;
+}
+
+static void heap_push(struct answer *answer)
+{
+	unsigned i;
+
+	if (heap_size == heap_capacity) {
+		heap_capacity = heap_capacity ? 2 * heap_capacity : 1024;
+		if (!(heap = realloc(heap, heap_capacity * sizeof(*heap)))) {
+			perror("realloc()");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	i = heap_size++;
+	heap[i] = answer;
+
+	while (i && heap[(i - 1) / 2]->due > heap[i]->due) {
+		heap_swap(i, (i - 1) / 2);
+		i = (i - 1) / 2;
+	}
+}
+
+static struct answer *heap_pop(void)
+{
+	struct answer *top = heap[0];
+	unsigned i = 0, child;
+
+	heap[0] = heap[--heap_size];
+
+	while ((child = 2 * i + 1) < heap_size) {
+		if (child + 1 < heap_size && heap[child + 1]->due < heap[child]->due)
+			child++;
+		if (heap[i]->due <= heap[child]->due)
+			break;
+
+		heap_swap(i, child);
+		i = child;
+	}
+
+	return top;
+}
+
+static void send_answer(struct answer *answer)
+{
+	if (sendto(answer->fd, answer->data, answer->size, 0,
+	           (struct sockaddr*)&answer->addr, answer->addrlen) == -1)
+		perror("sendto()");
+}
+
+static void send_due_answers(void)
+{
+	unsigned long t = now();
+	struct answer *answer;
+
+	while (heap_size && heap[0]->due <= t) {
+		answer = heap_pop();
+		send_answer(answer);
+		free(answer);
+	}
+}
+
+/* Delay is uniformly distributed between half and one and a half the latency */
+static struct answer *new_answer(int fd, struct sockaddr_storage *addr, socklen_t addrlen)
+{
+	struct answer *answer;
+
+	if (!(answer = malloc(sizeof(*answer)))) {
+		perror("malloc()");
+		exit(EXIT_FAILURE);
+	}
+
+	answer->due = now() + params.latency / 2 + rnd_below(params.latency + 1);
+	answer->fd = fd;
+	answer->addr = *addr;
+	answer->addrlen = addrlen;
+
+	memset(answer->data, 0xff, HEADER_SIZE);
+	answer->size = HEADER_SIZE;
+
+	return answer;
+}
+
+static void queue_answer(struct answer *answer)
+{
+	if (params.latency) {
+		heap_push(answer);
+	} else {
+		send_answer(answer);
+		free(answer);
+	}
+}
+
+static void append(struct answer *answer, const void *data, size_t size)
+{
+	if (answer->size + size <= PACKET_SIZE) {
+		memcpy(answer->data + answer->size, data, size);
+		answer->size += size;
+	}
+}
+
+/* Fields are nul terminated strings */
+static void append_field(struct answer *answer, const char *fmt, ...)
+{
+	char buf[64];
+	va_list ap;
+
+	va_start(ap, fmt);
+	vsnprintf(buf, sizeof(buf), fmt, ap);
+	va_end(ap);
+
+	append(answer, buf, strlen(buf) + 1);
+}
+
+static int is_vanilla(unsigned i)
+{
+	return i % 10 < 7;
+}
+
+static void init_servers(void)
+{
+	struct sim_server *sv;
+	unsigned i, j;
+
+	if (!(servers = calloc(params.nservers, sizeof(*servers)))) {
+		perror("calloc()");
+		exit(EXIT_FAILURE);
+	}
+
+	/* A third of servers are empty, the others are quite full */
+	for (i = 0; i < params.nservers; i++) {
+		sv = &servers[i];
+		sv->max_clients = is_vanilla(i) && i % 4 == 0 ? 8 : MAX_CLIENTS;
+		if (i % 3)
+			sv->nclients = 1 + rnd_below(sv->max_clients);
+
+		for (j = 0; j < sv->nclients; j++)
+			sv->clients[j] = (i * MAX_CLIENTS + j) % params.nplayers;
+	}
+}
+
+static int is_client(struct sim_server *sv, unsigned player)
+{
+	unsigned i;
+
+	for (i = 0; i < sv->nclients; i++)
+		if (sv->clients[i] == player)
+			return 1;
+
+	return 0;
+}
+
+/*
+ * Players leave with the given probability and are replaced by another
+ * one from the pool, hence the number of players on the server doesn't
+ * change.  Scores go up while playing.
+ */
+static void churn(struct sim_server *sv)
+{
+	unsigned i, player;
+
+	for (i = 0; i < sv->nclients; i++) {
+		if (rnd_below(100) < params.churn) {
+			do
+				player = rnd_below(params.nplayers);
+			while (is_client(sv, player));
+
+			sv->clients[i] = player;
+			sv->scores[i] = 0;
+		} else {
+			sv->scores[i] += rnd_below(10);
+		}
+	}
+}
+
+static void answer_info(unsigned i, struct sockaddr_storage *addr, socklen_t addrlen)
+{
+	struct sim_server *sv = &servers[i];
+	struct answer *answer;
+	unsigned j;
+
+	churn(sv);
+
+	answer = new_answer(fds[i + 1].fd, addr, addrlen);
+	append(answer, MSG_INFO, sizeof(MSG_INFO));
+
+	append_field(answer, "0");                           /* Token */
+	append_field(answer, "0.6.4");                       /* Version */
+	append_field(answer, "Simulated server #%u", i);     /* Name */
+	append_field(answer, "%s%u", is_vanilla(i) ? "ctf" : "dm", 1 + i % 7); /* Map */
+	append_field(answer, is_vanilla(i) ? "CTF" : "DM");  /* Gametype */
+	append_field(answer, "0");                           /* Flags */
+	append_field(answer, "%u", sv->nclients);            /* Player number */
+	append_field(answer, "%u", sv->max_clients);         /* Player max number */
+	append_field(answer, "%u", sv->nclients);            /* Client number */
+	append_field(answer, "%u", sv->max_clients);         /* Client max number */
+
+	for (j = 0; j < sv->nclients; j++) {
+		append_field(answer, "player%u", sv->clients[j]); /* Name */
+		append_field(answer, "clan%u", sv->clients[j] / 8); /* Clan */
+		append_field(answer, "-1");                   /* Country */
+		append_field(answer, "%d", sv->scores[j]);    /* Score */
+		append_field(answer, "1");                    /* Ingame? */
+	}
+
+	queue_answer(answer);
+
+	if (!sv->answered) {
+		sv->answered = 1;
+		round.nanswered++;
+	}
+	round.last_answer = now();
+}
+
+/* IPv4 addresses are IPv6 mapped in server lists */
+static void answer_list(struct sockaddr_storage *addr, socklen_t addrlen)
+{
+	static const uint8_t IPV4_HEADER[] = {
+		0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff, 127, 0, 0, 1
+	};
+	struct answer *answer = NULL;
+	uint8_t port[2];
+	unsigned i;
+
+	for (i = 0; i < params.nservers; i++) {
+		if (!answer) {
+			answer = new_answer(fds[0].fd, addr, addrlen);
+			append(answer, MSG_LIST, sizeof(MSG_LIST));
+		}
+
+		port[0] = (params.port + 1 + i) >> 8;
+		port[1] = (params.port + 1 + i) & 0xff;
+		append(answer, IPV4_HEADER, sizeof(IPV4_HEADER));
+		append(answer, port, sizeof(port));
+
+		if ((i + 1) % SERVERS_PER_LIST == 0 || i + 1 == params.nservers) {
+			queue_answer(answer);
+			answer = NULL;
+		}
+	}
+
+}
+
+static int has_header(uint8_t *buf, ssize_t size, const uint8_t *header)
+{
+	return size >= HEADER_SIZE + 8 && memcmp(buf + HEADER_SIZE, header, 8) == 0;
+}
+
+/* Socket 0 is the master, others are servers */
+static void handle_request(unsigned i, uint8_t *buf, ssize_t size,
+                           struct sockaddr_storage *addr, socklen_t addrlen)
+{
+	if (!round.start)
+		round.start = now();
+
+	round.nrequests++;
+	round.last_request = now();
+
+	if (i == 0)
+		round.nmaster_requests++;
+	else if (!servers[i - 1].nrequests++)
+		round.nrequested++;
+
+	if (rnd_below(100) < params.loss) {
+		round.ndropped++;
+		return;
+	}
+
+	if (i == 0 && has_header(buf, size, MSG_GETLIST))
+		answer_list(addr, addrlen);
+	else if (i > 0 && has_header(buf, size, MSG_GETINFO))
+		answer_info(i - 1, addr, addrlen);
+}
+
+static void receive(unsigned i)
+{
+	uint8_t buf[PACKET_SIZE];
+	struct sockaddr_storage addr;
+	socklen_t addrlen;
+	ssize_t size;
+
+	for (;;) {
+		addrlen = sizeof(addr);
+		size = recvfrom(fds[i].fd, buf, sizeof(buf), 0,
+		                (struct sockaddr*)&addr, &addrlen);
+		if (size == -1) {
+			if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+				perror("recvfrom()");
+			return;
+		}
+
+		handle_request(i, buf, size, &addr, addrlen);
+	}
+}
+
+/* Poll sockets until the next answer is due, or "timeout" at most */
+static void simulate(int timeout)
+{
+	unsigned i;
+	int ret;
+
+	if (heap_size) {
+		unsigned long t = now();
+		int wait = heap[0]->due > t ? heap[0]->due - t : 0;
+
+		if (wait < timeout)
+			timeout = wait;
+	}
+
+	ret = poll(fds, params.nservers + 1, timeout);
+	if (ret == -1 && errno != EINTR) {
+		perror("poll()");
+		exit(EXIT_FAILURE);
+	}
+
+	for (i = 0; ret > 0 && i <= params.nservers; i++) {
+		if (fds[i].revents & POLLIN) {
+			receive(i);
+			ret--;
+		}
+	}
+
+	send_due_answers();
+}
+
+/* There is one socket per server, hence a lot of file descriptors */
+static void raise_file_limit(void)
+{
+	struct rlimit rl;
+
+	if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+		rl.rlim_cur = rl.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &rl);
+	}
+}
+
+static void open_sockets(void)
+{
+	struct sockaddr_in addr;
+	unsigned i;
+	int fd;
+
+	raise_file_limit();
+
+	if (!(fds = calloc(params.nservers + 1, sizeof(*fds)))) {
+		perror("calloc()");
+		exit(EXIT_FAILURE);
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	for (i = 0; i <= params.nservers; i++) {
+		if ((fd = socket(AF_INET, SOCK_DGRAM, 0)) == -1) {
+			perror("socket()");
+			exit(EXIT_FAILURE);
+		}
+
+		addr.sin_port = htons(params.port + i);
+		if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) == -1) {
+			fprintf(stderr, "bind(127.0.0.1:%u): %s\n", params.port + i, strerror(errno));
+			exit(EXIT_FAILURE);
+		}
+
+		fcntl(fd, F_SETFL, O_NONBLOCK);
+		fds[i].fd = fd;
+		fds[i].events = POLLIN;
+	}
+}
+
+/*
+ * Servers are only requested again when the previous request timed
+ * out, hence every extra request is a retry.
+ */
+static void print_round(FILE *file, const char *label)
+{
+	unsigned long end = round.last_answer ? round.last_answer : round.last_request;
+	unsigned ninfos = round.nrequests - round.nmaster_requests;
+
+	fprintf(file, "%s: %u/%u servers answered in %.2fs, %u list requests, %u info requests, %u retries, %u dropped\n",
+	        label, round.nanswered, params.nservers,
+	        round.start ? (end - round.start) / 1000.0 : 0.0,
+	        round.nmaster_requests, ninfos, ninfos - round.nrequested,
+	        round.ndropped);
+}
+
+static void reset_round(void)
+{
+	static const struct round ROUND_ZERO;
+	unsigned i;
+
+	round = ROUND_ZERO;
+	for (i = 0; i < params.nservers; i++) {
+		servers[i].nrequests = 0;
+		servers[i].answered = 0;
+	}
+}
+
+/* Without teerank-update, print stats every few seconds */
+static int serve(void)
+{
+	unsigned long last = now();
+
+	printf("Master listening on 127.0.0.1:%u, servers on ports %u to %u\n",
+	       params.port, params.port + 1, params.port + params.nservers);
+	fflush(stdout);
+
+	while (!stop) {
+		simulate(1000);
+
+		if (now() - last >= 10000) {
+			print_round(stdout, "last 10s");
+			fflush(stdout);
+			reset_round();
+			last = now();
+		}
+	}
+
+	return EXIT_SUCCESS;
+}
+
+/* The simulated master is the only one teerank-update knows about */
+static void create_simulation_database(void)
+{
+	struct master master = { "127.0.0.1" };
+	struct stat st;
+
+	load_config();
+	if (stat(config.dbpath, &st) == 0) {
+		fprintf(stderr, "%s: Database already exists\n", config.dbpath);
+		exit(EXIT_FAILURE);
+	}
+
+	init_teerank(0);
+
+	snprintf(master.service, sizeof(master.service), "%u", params.port);
+	if (!exec("DELETE FROM masters") || !write_master(&master))
+		exit(EXIT_FAILURE);
+}
+
+static pid_t start_update(void)
+{
+	pid_t pid;
+
+	if ((pid = fork()) == -1) {
+		perror("fork()");
+		exit(EXIT_FAILURE);
+	}
+
+	if (pid == 0) {
+		execl(params.update, params.update, (char*)NULL);
+		perror(params.update);
+		_exit(EXIT_FAILURE);
+	}
+
+	return pid;
+}
+
+static int is_sweep_over(void)
+{
+	unsigned long t = now();
+
+	if (!round.start)
+		return 0;
+	if (round.nanswered == params.nservers)
+		return t - round.last_answer >= GRACE_DELAY;
+
+	/* Some servers didn't answer, and teerank-update gave up */
+	return round.nrequested && t - round.last_request >= IDLE_DELAY;
+}
+
+static unsigned long written_bytes(void)
+{
+	struct rusage usage;
+
+	if (getrusage(RUSAGE_CHILDREN, &usage) == -1)
+		return 0;
+
+	/* Blocks are 512 bytes long */
+	return usage.ru_oublock * 512UL;
+}
+
+static int run_round(unsigned n)
+{
+	unsigned long deadline, written;
+	char label[32];
+	pid_t pid;
+	int status;
+
+	reset_round();
+
+	/* Poll everything right away, like on a brand new database */
+	if (!exec("UPDATE servers SET expire = 0") || !exec("UPDATE masters SET expire = 0"))
+		return 0;
+
+	written = written_bytes();
+	deadline = now() + params.timeout * 1000UL;
+	pid = start_update();
+
+	while (!stop && !is_sweep_over() && now() < deadline) {
+		simulate(100);
+
+		if (waitpid(pid, &status, WNOHANG) == pid) {
+			fprintf(stderr, "%s: Exited unexpectedly\n", params.update);
+			return 0;
+		}
+	}
+
+	kill(pid, SIGTERM);
+	while (waitpid(pid, &status, 0) == -1 && errno == EINTR)
+		;
+
+	snprintf(label, sizeof(label), "round %u", n);
+	print_round(stdout, label);
+	printf("round %u: %lu KiB written to the database%s\n",
+	       n, (written_bytes() - written) / 1024,
+	       now() >= deadline ? ", timed out" : "");
+	fflush(stdout);
+
+	return 1;
+}
+
+static int harness(void)
+{
+	unsigned i;
+
+	create_simulation_database();
+
+	for (i = 1; i <= params.nrounds && !stop; i++)
+		if (!run_round(i))
+			return EXIT_FAILURE;
+
+	printf("%u players, %u servers in the database\n",
+	       count_rows("SELECT COUNT(1) FROM players"),
+	       count_rows("SELECT COUNT(1) FROM servers"));
+
+	return EXIT_SUCCESS;
+}
+
+static void usage(const char *bin)
+{
+	fprintf(stderr, "usage: %s [-s] [-n servers] [-p players] [-c churn] [-l loss] [-d latency] [-P port] [-r rounds] [-t timeout] [-u teerank-update]\n", bin);
+	fprintf(stderr, "Simulate a master and its servers, and run teerank-update against it using\n");
+	fprintf(stderr, "a new database at $TEERANK_DB.  With -s, only run the simulation.  Churn and\n");
+	fprintf(stderr, "loss are percentages, latency is in milliseconds and timeout in seconds.\n");
+	exit(EXIT_FAILURE);
+}
+
+static unsigned parse_unsigned(const char *bin, const char *str)
+{
+	char *end;
+	unsigned long n = strtoul(str, &end, 10);
+
+	if (!*str || *end)
+		usage(bin);
+
+	return n;
+}
+
+int main(int argc, char **argv)
+{
+	int c;
+
+	while ((c = getopt(argc, argv, "sn:p:c:l:d:P:r:t:u:")) != -1) {
+		switch (c) {
+		case 's': params.serve_only = 1; break;
+		case 'n': params.nservers = parse_unsigned(argv[0], optarg); break;
+		case 'p': params.nplayers = parse_unsigned(argv[0], optarg); break;
+		case 'c': params.churn = parse_unsigned(argv[0], optarg); break;
+		case 'l': params.loss = parse_unsigned(argv[0], optarg); break;
+		case 'd': params.latency = parse_unsigned(argv[0], optarg); break;
+		case 'P': params.port = parse_unsigned(argv[0], optarg); break;
+		case 'r': params.nrounds = parse_unsigned(argv[0], optarg); break;
+		case 't': params.timeout = parse_unsigned(argv[0], optarg); break;
+		case 'u': params.update = optarg; break;
+		default: usage(argv[0]);
+		}
+	}
+
+	/* Enough players for every servers to be full, and some more */
+	if (!params.nplayers)
+		params.nplayers = 8 * params.nservers + 2 * MAX_CLIENTS;
+
+	if (optind != argc || !params.nservers || params.port + params.nservers > 65535)
+		usage(argv[0]);
+	if (params.nplayers < 2 * MAX_CLIENTS)
+		usage(argv[0]);
+
+	signal(SIGINT, stop_gracefully);
+	signal(SIGTERM, stop_gracefully);
+
+	init_servers();
+	open_sockets();
+
+	if (params.serve_only)
+		return serve();
+	else
+		return harness();
+}
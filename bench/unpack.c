@@ -0,0 +1,687 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "server.h"
+#include "unpacker.h"
+
+/*
+ * Check update/unpacker.c against the unpacker it replaced, which is
+ * kept below as a reference.  Packets come from a corpus: seeds built
+ * here, looking like what real servers and masters send, and files
+ * given on the command line, for instance captured packets (UDP
+ * payloads without the six bytes connless header).
+ *
+ * By default, both unpackers are timed on the corpus.  With -f, the
+ * corpus is randomly mutated and both unpackers must agree on every
+ * mutated packets.  Build with -fsanitize=address to check for out of
+ * bounds accesses as well.
+ */
+
+static const uint8_t MSG_INFO[] = { 255, 255, 255, 255, 'i', 'n', 'f', '3' };
+static const uint8_t MSG_LIST[] = { 255, 255, 255, 255, 'l', 'i', 's', '2' };
+
+#define MAX_SEEDS 1024
+
+static struct packet seeds[MAX_SEEDS];
+static unsigned nseeds;
+
+/* Xorshift, see bench/generate.c */
+static unsigned state = 2463534242u;
+
+static unsigned rnd(void)
+{
+	state ^= state << 13;
+	state ^= state >> 17;
+	state ^= state << 5;
+	return state;
+}
+
+static unsigned rnd_below(unsigned n)
+{
+	return n ? rnd() % n : 0;
+}
+
+/* Monotonic time in nanoseconds */
+static double now(void)
+{
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) == -1)
+		return 0;
+
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/*
+ * Reference unpacker, as it was before update/unpacker.c was rewritten,
+ * but with client numbers checked to be positive.  Without this check,
+ * a negative client number would write past clients[].
+ */
+
+struct unpacker {
+	struct packet *packet;
+	size_t offset;
+};
+
+static int ref_skip_header(struct packet *packet, const uint8_t *header, size_t size)
+{
+	if (packet->size < size)
+		return 0;
+	if (memcmp(packet->buffer, header, size) != 0)
+		return 0;
+
+	packet->size -= size;
+	memmove(packet->buffer, &packet->buffer[size], packet->size);
+	return 1;
+}
+
+static int can_unpack(struct unpacker *up, unsigned length)
+{
+	unsigned offset;
+
+	for (offset = up->offset; offset < up->packet->size; offset++)
+		if (up->packet->buffer[offset] == 0)
+			if (--length == 0)
+				return 1;
+
+	return 0;
+}
+
+static char *unpack(struct unpacker *up)
+{
+	size_t old_offset = up->offset;
+
+	while (up->offset < up->packet->size
+	       && up->packet->buffer[up->offset] != 0)
+		up->offset++;
+
+	up->offset++;
+	return (char*)&up->packet->buffer[old_offset];
+}
+
+static void ref_unpack_string(struct unpacker *up, char *buf, size_t size)
+{
+	snprintf(buf, size, "%s", unpack(up));
+}
+
+static long int ref_unpack_int(struct unpacker *up)
+{
+	long ret;
+	char *str, *endptr;
+
+	str = unpack(up);
+	errno = 0;
+	ret = strtol(str, &endptr, 10);
+
+	if (errno == ERANGE && ret == LONG_MIN)
+		fprintf(stderr, "unpack_int(%s): Underflow, value truncated\n", str);
+	else if (errno == ERANGE && ret == LONG_MAX)
+		fprintf(stderr, "unpack_int(%s): Overflow, value truncated\n", str);
+	else if (endptr == str)
+		fprintf(stderr, "unpack_int(%s): Cannot convert string\n", str);
+	return ret;
+}
+
+static int ref_unpack_server_info(struct packet *packet, struct server *sv)
+{
+	struct unpacker up;
+	struct server old;
+	unsigned i;
+
+	if (!ref_skip_header(packet, MSG_INFO, sizeof(MSG_INFO)))
+		return 0;
+
+	up.packet = packet;
+	up.offset = 0;
+	old = *sv;
+
+	if (!can_unpack(&up, 10))
+		goto fail;
+
+	unpack(&up);
+	unpack(&up);
+	ref_unpack_string(&up, sv->name,     sizeof(sv->name));
+	ref_unpack_string(&up, sv->map,      sizeof(sv->map));
+	ref_unpack_string(&up, sv->gametype, sizeof(sv->gametype));
+
+	unpack(&up);
+	unpack(&up);
+	unpack(&up);
+	sv->num_clients = ref_unpack_int(&up);
+	sv->max_clients = ref_unpack_int(&up);
+
+	if (sv->num_clients < 0)
+		goto fail;
+	if (sv->num_clients > MAX_CLIENTS)
+		goto fail;
+	if (sv->max_clients > MAX_CLIENTS)
+		goto fail;
+	if (sv->num_clients > sv->max_clients)
+		goto fail;
+
+	for (i = 0; i < sv->num_clients; i++) {
+		struct client *cl = &sv->clients[i];
+
+		if (!can_unpack(&up, 5))
+			goto fail;
+
+		ref_unpack_string(&up, cl->name, sizeof(cl->name));
+		ref_unpack_string(&up, cl->clan, sizeof(cl->clan));
+
+		unpack(&up);
+		cl->score  = ref_unpack_int(&up);
+		cl->ingame = ref_unpack_int(&up);
+	}
+
+	return 1;
+fail:
+	*sv = old;
+	return 0;
+}
+
+/* IPv4 addresses are mapped to IPv6 ones */
+static const uint8_t V4[] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff };
+
+/* Addresses are 16 bytes IPs and 2 bytes ports, this one was fine */
+static unsigned ref_unpack_server_addr(struct packet *packet, char *buf, size_t size)
+{
+	unsigned char *raw;
+	unsigned n = 0, len = 0;
+	int i;
+
+	if (!ref_skip_header(packet, MSG_LIST, sizeof(MSG_LIST)))
+		return 0;
+
+	for (i = 0; i + 18 <= packet->size; i += 18, n++) {
+		raw = &packet->buffer[i];
+		if (memcmp(raw, V4, sizeof(V4)) != 0)
+			continue;
+		len += snprintf(buf + len, size - len, "%u.%u.%u.%u:%u ",
+		                raw[12], raw[13], raw[14], raw[15],
+		                (raw[16] << 8) | raw[17]);
+	}
+
+	return n;
+}
+
+/* Only IPv4 addresses are compared, that's what seeds have */
+static unsigned list_addrs(struct packet *packet, char *buf, size_t size)
+{
+	unsigned n = 0, len = 0;
+	int reset_context = 1;
+	char *ip, *port;
+
+	while (unpack_server_addr(packet, &ip, &port, &reset_context)) {
+		if (!strchr(ip, ':'))
+			len += snprintf(buf + len, size - len, "%s:%s ", ip, port);
+		n++;
+	}
+
+	return n;
+}
+
+/*
+ * Seeds
+ */
+
+static struct packet *new_seed(const uint8_t *header, size_t size)
+{
+	struct packet *packet;
+
+	if (nseeds == MAX_SEEDS) {
+		fprintf(stderr, "Too many packets in the corpus\n");
+		exit(EXIT_FAILURE);
+	}
+
+	packet = &seeds[nseeds++];
+	memcpy(packet->buffer, header, size);
+	packet->size = size;
+	return packet;
+}
+
+static void field(struct packet *packet, const char *fmt, ...)
+{
+	size_t left = PACKET_SIZE - packet->size;
+	va_list ap;
+	int ret;
+
+	if (!left)
+		return;
+
+	va_start(ap, fmt);
+	ret = vsnprintf((char*)&packet->buffer[packet->size], left, fmt, ap);
+	va_end(ap);
+
+	packet->size += ret < left ? ret + 1 : left;
+}
+
+static void info_header(
+	struct packet *packet, const char *name, const char *map,
+	const char *gametype, unsigned nclients, unsigned max_clients)
+{
+	field(packet, "%u", rnd());       /* Token */
+	field(packet, "0.6.4");           /* Version */
+	field(packet, "%s", name);        /* Name */
+	field(packet, "%s", map);         /* Map */
+	field(packet, "%s", gametype);    /* Gametype */
+	field(packet, "0");               /* Flags */
+	field(packet, "%u", nclients);    /* Player number */
+	field(packet, "%u", max_clients); /* Player max number */
+	field(packet, "%u", nclients);    /* Client number */
+	field(packet, "%u", max_clients); /* Client max number */
+}
+
+static void client(
+	struct packet *packet, const char *name, const char *clan,
+	int country, int score, int ingame)
+{
+	field(packet, "%s", name);
+	field(packet, "%s", clan);
+	field(packet, "%d", country);
+	field(packet, "%d", score);
+	field(packet, "%d", ingame);
+}
+
+static void build_seeds(void)
+{
+	static const char *NAMES[] = {
+		"nameless tee", "(1)nameless tee", "brainless tee", "N\xc3\xa9o",
+		"\xe2\x98\x85 star \xe2\x98\x85", "abcdefghijklmno", "sixteen chars!!!",
+		"", "  spaces  ", "%s%n", "123", "-1"
+	};
+	static const char *CLANS[] = {
+		"", "Team", "\xd0\x9a\xd0\xbb\xd0\xb0\xd0\xbd", "abcdefghijklmnopqrst"
+	};
+	struct packet *packet;
+	char longstr[300];
+	unsigned i, n;
+
+	/* Full vanilla CTF server */
+	packet = new_seed(MSG_INFO, sizeof(MSG_INFO));
+	info_header(packet, "Teeworlds CTF", "ctf2", "CTF", 16, 16);
+	for (i = 0; i < 16; i++)
+		client(packet, NAMES[i % 12], CLANS[i % 4], i * 37 % 1000 - 1,
+		       (int)rnd_below(100) - 10, 1);
+
+	/* Empty server */
+	packet = new_seed(MSG_INFO, sizeof(MSG_INFO));
+	info_header(packet, "Empty", "dm1", "DM", 0, 16);
+
+	/* Some servers have more players than clients, and spectators */
+	for (n = 1; n <= 8; n++) {
+		packet = new_seed(MSG_INFO, sizeof(MSG_INFO));
+		info_header(packet, "Teeworlds DM", "dm2", "DM", n, 8 + n);
+		for (i = 0; i < n; i++)
+			client(packet, NAMES[(i + n) % 12], CLANS[(i + n) % 4],
+			       -1, -(int)i, i % 3 != 0);
+	}
+
+	/* Strings longer than our buffers */
+	memset(longstr, 'x', sizeof(longstr) - 1);
+	longstr[sizeof(longstr) - 1] = '\0';
+	packet = new_seed(MSG_INFO, sizeof(MSG_INFO));
+	info_header(packet, longstr, longstr + 200, "DDraceNetwork", 2, 16);
+	client(packet, longstr + 280, longstr + 270, 276, 99999, 1);
+	client(packet, NAMES[4], CLANS[2], 0, -9999, 0);
+
+	/* Some mods have 64 clients, we don't support that */
+	packet = new_seed(MSG_INFO, sizeof(MSG_INFO));
+	info_header(packet, "64 slots", "Kobra 4", "DDNet", 20, 64);
+	for (i = 0; i < 20; i++)
+		client(packet, NAMES[i % 12], CLANS[i % 4], -1, -9999, 1);
+
+	/* Truncated in the middle of the last client */
+	packet = new_seed(MSG_INFO, sizeof(MSG_INFO));
+	info_header(packet, "Truncated", "ctf1", "CTF", 4, 8);
+	for (i = 0; i < 4; i++)
+		client(packet, NAMES[i], CLANS[i], -1, 0, 1);
+	packet->size -= 3;
+
+	/* Numbers that strtol() is needed for */
+	packet = new_seed(MSG_INFO, sizeof(MSG_INFO));
+	field(packet, "0"); field(packet, "0.6.4"); field(packet, "Odd numbers");
+	field(packet, "ctf3"); field(packet, "CTF"); field(packet, "0");
+	field(packet, "1"); field(packet, "16"); field(packet, " 1");
+	field(packet, "+16");
+	field(packet, "odd"); field(packet, "%s", ""); field(packet, "-1");
+	field(packet, "4294967296"); field(packet, "1x");
+
+	/* Master lists */
+	for (n = 0; n < 3; n++) {
+		packet = new_seed(MSG_LIST, sizeof(MSG_LIST));
+		for (i = 0; i < 25 * n + 1; i++) {
+			uint8_t *raw = &packet->buffer[packet->size];
+
+			memcpy(raw, V4, sizeof(V4));
+			raw[12] = 10;
+			raw[13] = i;
+			raw[14] = n;
+			raw[15] = rnd();
+			raw[16] = 0x20;
+			raw[17] = 0x6f + i;
+			packet->size += 18;
+		}
+	}
+}
+
+static void load_file(const char *path)
+{
+	struct packet *packet;
+	FILE *file;
+
+	if (!(file = fopen(path, "rb"))) {
+		perror(path);
+		exit(EXIT_FAILURE);
+	}
+
+	packet = new_seed((const uint8_t*)"", 0);
+	packet->size = fread(packet->buffer, 1, PACKET_SIZE, file);
+	fclose(file);
+}
+
+/* Load a packet, or every packets in a directory */
+static void load_corpus(const char *path)
+{
+	char file[PATH_MAX];
+	struct dirent *dp;
+	struct stat st;
+	DIR *dir;
+
+	if (stat(path, &st) == -1) {
+		perror(path);
+		exit(EXIT_FAILURE);
+	}
+
+	if (!S_ISDIR(st.st_mode)) {
+		load_file(path);
+		return;
+	}
+
+	if (!(dir = opendir(path))) {
+		perror(path);
+		exit(EXIT_FAILURE);
+	}
+
+	while ((dp = readdir(dir))) {
+		if (dp->d_name[0] == '.')
+			continue;
+		snprintf(file, sizeof(file), "%s/%s", path, dp->d_name);
+		load_file(file);
+	}
+
+	closedir(dir);
+}
+
+static void write_corpus(const char *path)
+{
+	char file[PATH_MAX];
+	FILE *out;
+	unsigned i;
+
+	for (i = 0; i < nseeds; i++) {
+		snprintf(file, sizeof(file), "%s/seed-%02u", path, i);
+		if (!(out = fopen(file, "wb"))) {
+			perror(file);
+			exit(EXIT_FAILURE);
+		}
+		fwrite(seeds[i].buffer, 1, seeds[i].size, out);
+		fclose(out);
+	}
+
+	printf("%u packets written to %s\n", nseeds, path);
+}
+
+/*
+ * Benchmark
+ */
+
+static void benchmark(unsigned iterations)
+{
+	static struct server sv;
+	struct packet copy;
+	double start, ref, new;
+	unsigned i, j, nref = 0, nnew = 0;
+
+	start = now();
+	for (i = 0; i < iterations; i++) {
+		for (j = 0; j < nseeds; j++) {
+			copy.size = seeds[j].size;
+			memcpy(copy.buffer, seeds[j].buffer, copy.size);
+			nref += ref_unpack_server_info(&copy, &sv);
+		}
+	}
+	ref = now() - start;
+
+	start = now();
+	for (i = 0; i < iterations; i++) {
+		for (j = 0; j < nseeds; j++) {
+			copy.size = seeds[j].size;
+			memcpy(copy.buffer, seeds[j].buffer, copy.size);
+			nnew += unpack_server_info(&copy, &sv);
+		}
+	}
+	new = now() - start;
+
+	printf("%u packets, %u times\n", nseeds, iterations);
+	if (nref != nnew)
+		printf("Unpackers disagree, use -f to find out why\n");
+	printf("reference: %8.1f ns per packet\n", ref / iterations / nseeds);
+	printf("new:       %8.1f ns per packet (%.2fx)\n",
+	       new / iterations / nseeds, ref / new);
+}
+
+/*
+ * Fuzzer
+ */
+
+static void mutate(struct packet *packet)
+{
+	unsigned i, n, pos;
+
+	for (n = 1 + rnd_below(4); n; n--) {
+		pos = rnd_below(packet->size);
+
+		switch (rnd_below(6)) {
+		case 0: /* Random byte */
+			if (packet->size)
+				packet->buffer[pos] = rnd();
+			break;
+		case 1: /* End a field early */
+			if (packet->size)
+				packet->buffer[pos] = 0;
+			break;
+		case 2: /* Merge two fields */
+			for (i = pos; i < packet->size; i++) {
+				if (!packet->buffer[i]) {
+					packet->buffer[i] = 'a' + rnd_below(26);
+					break;
+				}
+			}
+			break;
+		case 3: /* Number, maybe a big one */
+			if (packet->size)
+				packet->buffer[pos] = "-0123456789"[rnd_below(11)];
+			break;
+		case 4: /* Truncate */
+			packet->size = pos;
+			break;
+		case 5: /* Insert digits */
+			i = 1 + rnd_below(20);
+			if (packet->size + i > PACKET_SIZE)
+				break;
+			memmove(&packet->buffer[pos + i], &packet->buffer[pos],
+			        packet->size - pos);
+			memset(&packet->buffer[pos], '9', i);
+			packet->size += i;
+			break;
+		}
+	}
+}
+
+static int same_server(struct server *a, struct server *b)
+{
+	unsigned i;
+
+	if (strcmp(a->name, b->name) || strcmp(a->map, b->map))
+		return 0;
+	if (strcmp(a->gametype, b->gametype))
+		return 0;
+	if (a->num_clients != b->num_clients || a->max_clients != b->max_clients)
+		return 0;
+
+	for (i = 0; i < MAX_CLIENTS; i++) {
+		struct client *ca = &a->clients[i], *cb = &b->clients[i];
+
+		if (strcmp(ca->name, cb->name) || strcmp(ca->clan, cb->clan))
+			return 0;
+		if (ca->score != cb->score || ca->ingame != cb->ingame)
+			return 0;
+	}
+
+	return 1;
+}
+
+static void dump(struct packet *packet)
+{
+	int i;
+
+	for (i = 0; i < packet->size; i++)
+		printf("%02x%s", packet->buffer[i], i % 32 == 31 ? "\n" : " ");
+	printf("\n");
+}
+
+static int check(struct packet *packet)
+{
+	static const struct server SERVER_ZERO;
+	static struct server a, b;
+	static char la[8192], lb[8192];
+	struct packet copy, orig;
+	int ra, rb;
+
+	a = b = SERVER_ZERO;
+	strcpy(a.name, "previous");
+	strcpy(b.name, "previous");
+	la[0] = lb[0] = '\0';
+
+	orig = *packet;
+
+	copy = *packet;
+	ra = ref_unpack_server_info(&copy, &a);
+	rb = unpack_server_info(packet, &b);
+
+	if (ra != rb || !same_server(&a, &b)) {
+		printf("unpack_server_info() returned %d, reference %d\n", rb, ra);
+		goto fail;
+	}
+
+	copy = *packet;
+	ra = ref_unpack_server_addr(&copy, la, sizeof(la));
+	rb = list_addrs(packet, lb, sizeof(lb));
+
+	if (ra != rb || strcmp(la, lb)) {
+		printf("unpack_server_addr() returned %d addresses, reference %d\n", rb, ra);
+		goto fail;
+	}
+
+	/* Packets are now read in place */
+	if (packet->size != orig.size
+	    || memcmp(packet->buffer, orig.buffer, orig.size)) {
+		printf("Packet was modified\n");
+		goto fail;
+	}
+
+	return 1;
+
+fail:
+	dump(&orig);
+	return 0;
+}
+
+static int fuzz(unsigned iterations)
+{
+	struct packet packet;
+	unsigned i;
+
+	/* Both unpackers complain about invalid numbers */
+	if (!freopen("/dev/null", "w", stderr))
+		perror("/dev/null");
+
+	for (i = 0; i < nseeds; i++)
+		if (!check(&seeds[i]))
+			return EXIT_FAILURE;
+
+	for (i = 0; i < iterations; i++) {
+		packet = seeds[rnd_below(nseeds)];
+		mutate(&packet);
+
+		if (!check(&packet))
+			return EXIT_FAILURE;
+	}
+
+	printf("%u packets, %u mutations, no differences\n", nseeds, iterations);
+	return EXIT_SUCCESS;
+}
+
+static void usage(const char *bin)
+{
+	fprintf(stderr, "usage: %s [-n iterations] [-f mutations] [-S seed] [-w dir] [packet|dir...]\n", bin);
+	fprintf(stderr, "Time the server info unpacker against the previous one, or with -f, check\n");
+	fprintf(stderr, "they agree on randomly mutated packets.  Packets given on the command line\n");
+	fprintf(stderr, "are used instead of the built-in ones, -w writes the built-in ones.\n");
+	exit(EXIT_FAILURE);
+}
+
+static unsigned parse_unsigned(const char *bin, const char *str)
+{
+	char *end;
+	unsigned long n = strtoul(str, &end, 10);
+
+	if (!*str || *end)
+		usage(bin);
+
+	return n;
+}
+
+int main(int argc, char **argv)
+{
+	unsigned iterations = 100000, mutations = 0;
+	const char *corpus = NULL;
+	int c;
+
+	while ((c = getopt(argc, argv, "n:f:S:w:")) != -1) {
+		switch (c) {
+		case 'n': iterations = parse_unsigned(argv[0], optarg); break;
+		case 'f': mutations = parse_unsigned(argv[0], optarg); break;
+		case 'S': state = parse_unsigned(argv[0], optarg) | 1; break;
+		case 'w': corpus = optarg; break;
+		default: usage(argv[0]);
+		}
+	}
+
+	if (optind == argc)
+		build_seeds();
+	for (; optind < argc; optind++)
+		load_corpus(argv[optind]);
+
+	if (!nseeds)
+		usage(argv[0]);
+
+	if (corpus) {
+		write_corpus(corpus);
+		return EXIT_SUCCESS;
+	}
+
+	if (mutations)
+		return fuzz(mutations);
+
+	benchmark(iterations);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,110 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "teerank.h"
+#include "cgi.h"
+#include "cache.h"
+
+#define CACHE_SLOTS 4096
+
+/*
+ * Pages show elapsed times ("5 minutes ago"), so even when the database
+ * doesn't change, a cached page can't be served forever.
+ */
+#define CACHE_MAX_AGE 60
+
+static void slot_path(char *path, size_t size, const char *key)
+{
+	snprintf(path, size, "%s/%03x", config.cache, hash_string(key) % CACHE_SLOTS);
+}
+
+/*
+ * Each entry start with a line containing the database modification
+ * date and the key, then the response as it should be sent.
+ */
+char *read_cache(const char *key, time_t mtime, size_t *size)
+{
+	char path[PATH_MAX], *buf, *line;
+	unsigned long date;
+	struct stat st;
+	FILE *file;
+	size_t len;
+
+	slot_path(path, sizeof(path), key);
+
+	if (!(file = fopen(path, "r")))
+		return NULL;
+
+	if (fstat(fileno(file), &st) == -1 || time(NULL) - st.st_mtime > CACHE_MAX_AGE) {
+		fclose(file);
+		return NULL;
+	}
+
+	if (!(buf = malloc(st.st_size + 1))) {
+		fclose(file);
+		return NULL;
+	}
+
+	len = fread(buf, 1, st.st_size, file);
+	fclose(file);
+	buf[len] = '\0';
+
+	/* Check the header, a different key means another URL took the slot */
+	if (!(line = memchr(buf, '\n', len)))
+		goto miss;
+	*line++ = '\0';
+
+	if (sscanf(buf, "%lu", &date) != 1 || date != (unsigned long)mtime)
+		goto miss;
+	if (!strchr(buf, ' ') || strcmp(strchr(buf, ' ') + 1, key) != 0)
+		goto miss;
+
+	*size = len - (line - buf);
+	memmove(buf, line, *size);
+	return buf;
+
+miss:
+	free(buf);
+	return NULL;
+}
+
+void write_cache(const char *key, time_t mtime, const struct iovec *iov, int iovcnt)
+{
+	char path[PATH_MAX], tmp[PATH_MAX];
+	FILE *file;
+	int i;
+
+	/*
+	 * The database modification date has a one second resolution,
+	 * so it could still be modified during the current second
+	 * without any change of the date.  Don't cache in this case,
+	 * the response could already be outdated.
+	 */
+	if (mtime >= time(NULL))
+		return;
+
+	slot_path(path, sizeof(path), key);
+	snprintf(tmp, sizeof(tmp), "%s.%ld.tmp", path, (long)getpid());
+
+	if (!(file = fopen(tmp, "w"))) {
+		perror(tmp);
+		return;
+	}
+
+	fprintf(file, "%lu %s\n", (unsigned long)mtime, key);
+	for (i = 0; i < iovcnt; i++)
+		fwrite(iov[i].iov_base, 1, iov[i].iov_len, file);
+
+	/*
+	 * Write to a temporary file and then rename it, so that
+	 * concurrent readers never see a partial entry.
+	 */
+	if (fclose(file) != 0 || rename(tmp, path) == -1) {
+		perror(tmp);
+		unlink(tmp);
+	}
+}
@@ -0,0 +1,29 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <time.h>
+#include <sys/uio.h>
+
+/*
+ * Most pages only change when teerank-update commits something in the
+ * database.  So keep fully rendered responses on disk, in the
+ * directory given by TEERANK_CACHE, and serve them as long as the
+ * database didn't change.
+ *
+ * Entries are stored in a fixed number of slots, picked by hashing the
+ * key.  Two keys using the same slot just replace each other, hence the
+ * cache size is bounded no matter how many different URLs are requested.
+ */
+
+/*
+ * Return the cached response for the given key, or NULL if there is
+ * none, if it was made with a different database modification date, or
+ * if it is simply too old.
+ * Returned buffer must be free()'d.
+ */
+char *read_cache(const char *key, time_t mtime, size_t *size);
+
+/* Store the given response, split in multiple buffers */
+void write_cache(const char *key, time_t mtime, const struct iovec *iov, int iovcnt);
+
+#endif /* CACHE_H */
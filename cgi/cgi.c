@@ -8,20 +8,56 @@
 #include <limits.h>
 #include <unistd.h>
 #include <sys/wait.h>
+#include <sys/uio.h>
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <dirent.h>
 #include <libgen.h>
 #include <ctype.h>
+#include <setjmp.h>
+#include <time.h>
 
 #include "teerank.h"
 #include "route.h"
 #include "cgi.h"
+#include "scgi.h"
+#include "cache.h"
+#include "database.h"
+#include "server.h"
+#include "html.h"
 
 struct cgi_config cgi_config = {
 	"teerank.com", "80"
 };
 
+/*
+ * Within serve_request(), error() and redirect() can't exit() because
+ * the process may handle many requests (SCGI mode for instance).
+ * Instead they jump back to serve_request().
+ */
+static jmp_buf request_env;
+static int in_request;
+
+static void end_request(void)
+{
+	if (in_request)
+		longjmp(request_env, 1);
+
+	exit(EXIT_FAILURE);
+}
+
+/*
+ * CGI variables are stored in the environment, but in SCGI mode they
+ * come along with the request.
+ */
+static char *getparam(const char *name)
+{
+	if (*config.scgi)
+		return scgi_getenv(name);
+	else
+		return getenv(name);
+}
+
 int parse_pnum(const char *str, unsigned *pnum)
 {
 	long ret;
@@ -48,6 +84,37 @@ int parse_pnum(const char *str, unsigned *pnum)
 	return 1;
 }
 
+int parse_server_key(const char *str, unsigned *nplayers, char *ip, char *port)
+{
+	const char *sip, *sport;
+
+	if (sscanf(str, "%u,", nplayers) != 1)
+		return 0;
+	if (!(sip = strchr(str, ',')) || !(sport = strchr(++sip, ',')))
+		return 0;
+	sport++;
+
+	if (sport - sip > IP_STRSIZE || strlen(sport) >= PORT_STRSIZE)
+		return 0;
+
+	memcpy(ip, sip, sport - sip - 1);
+	ip[sport - sip - 1] = '\0';
+	strcpy(port, sport);
+
+	return 1;
+}
+
+unsigned hash_string(const char *str)
+{
+	unsigned h = 2166136261u;
+
+	/* FNV-1a */
+	while (*str)
+		h = (h ^ (unsigned char)*str++) * 16777619u;
+
+	return h;
+}
+
 static int safe_for_urls(char c)
 {
 	if (isalnum(c))
@@ -189,6 +256,62 @@ char *absurl(const char *fmt, ...)
 	return url;
 }
 
+/*
+ * Response body of the page being generated.  It is a growable buffer,
+ * so that a failing page doesn't send anything, and so that headers can
+ * be decided once the page is done.
+ */
+static FILE *body;
+static char *bodybuf;
+static size_t bodysize;
+
+void vout(const char *fmt, va_list ap)
+{
+	if (body)
+		vfprintf(body, fmt, ap);
+	else
+		vprintf(fmt, ap);
+}
+
+void out(const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	vout(fmt, ap);
+	va_end(ap);
+}
+
+static void discard_body(void)
+{
+	if (body) {
+		fclose(body);
+		free(bodybuf);
+		body = NULL;
+		bodybuf = NULL;
+	}
+}
+
+/*
+ * What was sent and how long it took, for Server-Timing and the access
+ * log.  Bytes are only counted for responses sent with send_iov().
+ */
+static struct {
+	int status;
+	size_t bytes;
+	double start, route_ms;
+} response;
+
+static double now_ms(void)
+{
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) == -1)
+		return 0;
+
+	return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
 static char *reason_phrase(int code)
 {
 	switch (code) {
@@ -198,12 +321,15 @@ static char *reason_phrase(int code)
 	case 404: return "Not Found";
 	case 414: return "Request-URI Too Long";
 	case 500: return "Internal Server Error";
+	case 503: return "Service Unavailable";
 	default:  return "";
 	}
 }
 
 static void print_error(int code)
 {
+	response.status = code;
+
 	printf("Content-type: text/html\n");
 	printf("Status: %d %s\n", code, reason_phrase(code));
 	printf("\n");
@@ -214,6 +340,9 @@ void error(int code, char *fmt, ...)
 {
 	va_list ap;
 
+	/* Content generated so far, if any, must not be sent */
+	discard_body();
+
 	print_error(code);
 	if (fmt) {
 		va_start(ap, fmt);
@@ -227,7 +356,7 @@ void error(int code, char *fmt, ...)
 		fprintf(stderr, "%d %s\n", code, reason_phrase(code));
 	}
 
-	exit(EXIT_FAILURE);
+	end_request();
 }
 
 void redirect(const char *fmt, ...)
@@ -237,6 +366,9 @@ void redirect(const char *fmt, ...)
 	assert(fmt != NULL);
 	assert(fmt[0] == '/');
 
+	discard_body();
+
+	response.status = 301;
 	printf("Status: %d %s\n", 301, reason_phrase(301));
 	printf("Location: http://%s", cgi_config.domain);
 
@@ -247,58 +379,120 @@ void redirect(const char *fmt, ...)
 	putchar('\n');
 	putchar('\n');
 
-	exit(EXIT_FAILURE);
+	end_request();
 }
 
-/*
- * And http status is passed to the function because in order to dum the
- * content of fd, we need to fdopen() it, and it can fail.  If that fail
- * we want to print an error.
- */
-static int dump(int status, const char *content_type, int fd, FILE *copy)
+/* Write every buffers, even if writev() doesn't do it at once */
+static int writev_all(int fd, struct iovec *iov, int iovcnt)
 {
-	FILE *file;
-	int c;
-
-	assert(fd != -1);
+	ssize_t ret;
 
-	if (!(file = fdopen(fd, "r")))
-		error(500, "fdopen(): %s\n", strerror(errno));
+	while (iovcnt) {
+		ret = writev(fd, iov, iovcnt);
+		if (ret == -1 && errno == EINTR)
+			continue;
+		if (ret == -1)
+			return 0;
 
-	if (status != 200) {
-		print_error(status);
-	} else {
-		printf("Content-Type: %s\n", content_type);
-		printf("\n");
-	}
+		while (iovcnt && ret >= iov->iov_len) {
+			ret -= iov->iov_len;
+			iov++;
+			iovcnt--;
+		}
 
-	if (copy) {
-		while ((c = fgetc(file)) != EOF) {
-			putchar(c);
-			fputc(c, copy);
+		if (iovcnt) {
+			iov->iov_base = (char*)iov->iov_base + ret;
+			iov->iov_len -= ret;
 		}
-	} else {
-		while ((c = fgetc(file)) != EOF)
-			putchar(c);
 	}
 
-	fclose(file);
-	close(fd);
-
 	return 1;
 }
 
-static void raw_dump(int fd, FILE *dst)
+static void send_iov(struct iovec *iov, int iovcnt)
+{
+	int i;
+
+	/* Headers and body must come after anything printed before */
+	fflush(stdout);
+
+	for (i = 0; i < iovcnt; i++)
+		response.bytes += iov[i].iov_len;
+
+	if (!writev_all(STDOUT_FILENO, iov, iovcnt))
+		perror("writev()");
+}
+
+/*
+ * What we know about the response before running the route: it only
+ * depends on the URL and the database content.
+ */
+struct request {
+	char key[2 * 1024 + MAX_DOMAIN_LENGTH];
+	time_t mtime;
+
+	/* Validators, to answer conditional requests */
+	char etag[32];
+	char last_modified[32];
+
+	/* The client has it already, if the route does succeed */
+	int not_modified;
+};
+
+static void send_not_modified(struct request *req)
+{
+	response.status = 304;
+	printf("Status: 304 Not Modified\n");
+	printf("Last-Modified: %s\n", req->last_modified);
+	printf("ETag: %s\n", req->etag);
+	printf("\n");
+}
+
+static void send_response(const char *content_type, struct request *req)
 {
-	FILE *src;
-	int c;
+	char headers[512], timing[128];
+	struct iovec iov[4], cached[3];
+	int ret;
+
+	ret = snprintf(
+		headers, sizeof(headers),
+		"Content-Type: %s\nLast-Modified: %s\nETag: %s\n",
+		content_type, req->last_modified, req->etag);
+	if (ret >= sizeof(headers))
+		error(500, "%s: Content type too long\n", content_type);
 
-	if (!(src = fdopen(fd, "r")))
-		error(500, "fdopen(): %s\n", strerror(errno));
-	while ((c = fgetc(src)) != EOF)
-		fputc(c, dst);
-	fclose(src);
-	close(fd);
+	iov[0].iov_base = headers;
+	iov[0].iov_len = ret;
+
+	/*
+	 * Timings are only true for this very response, so they are
+	 * not part of the cached one.
+	 */
+	iov[1].iov_base = timing;
+	iov[1].iov_len = snprintf(
+		timing, sizeof(timing),
+		"Server-Timing: route;dur=%.3f, sql;dur=%.3f;desc=\"%u queries, %u rows\"\n",
+		response.route_ms, query_stats.ms, query_stats.queries, query_stats.rows);
+
+	iov[2].iov_base = "\n";
+	iov[2].iov_len = 1;
+	iov[3].iov_base = bodybuf;
+	iov[3].iov_len = bodysize;
+
+	if (*config.cache) {
+		cached[0] = iov[0];
+		cached[1] = iov[2];
+		cached[2] = iov[3];
+		write_cache(req->key, req->mtime, cached, 3);
+	}
+
+	if (req->not_modified) {
+		send_not_modified(req);
+		return;
+	}
+
+	response.status = 200;
+	send_iov(iov, 4);
 }
 
 static int route_argc(struct route *route)
@@ -311,82 +505,41 @@ static int route_argc(struct route *route)
 	return i;
 }
 
-static int generate(struct route *route)
+/* Run the route and send its output, caching it when enabled */
+static int generate(struct route *route, struct request *req)
 {
-	int out[2], err[2];
-	int stdout_save, stderr_save;
 	int ret;
 
 	assert(route != NULL);
 
 	verbose("Generating data with '%s'", route->args[0]);
 
-	/*
-	 * Create a pipe to redirect stdout and stderr to.  It is
-	 * necessary because when a failure happen we don't want to send
-	 * any content generated before the failure.  Intsead we want to
-	 * print something from the error stream.
-	 */
-	if (pipe(out) == -1)
-		error(500, "pipe(out): %s\n", strerror(errno));
-	if (pipe(err) == -1)
-		error(500, "pipe(err): %s\n", strerror(errno));
-
-	/*
-	 * Duplicate stdout and stderr so we can replace them with our
-	 * previsouly created pipes, and then restore them to their
-	 * actual value once route generation is done.
-	 */
-
-	stdout_save = dup(STDOUT_FILENO);
-	if (stdout_save == -1)
-		error(500, "dup(out): %s\n", strerror(errno));
-
-	stderr_save = dup(STDERR_FILENO);
-	if (stderr_save == -1)
-		error(500, "dup(err): %s\n", strerror(errno));
-
-	/* Replace stdout and stderr */
-	if (dup2(out[1], STDOUT_FILENO) == -1)
-		error(500, "dup2(out): %s\n", strerror(errno));
-	if (dup2(err[1], STDERR_FILENO) == -1)
-		error(500, "dup2(err): %s\n", strerror(errno));
-	close(out[1]);
-	close(err[1]);
+	if (!(body = open_memstream(&bodybuf, &bodysize)))
+		error(500, "open_memstream(): %s\n", strerror(errno));
 
 	/* Run route generation */
+	response.route_ms = now_ms();
 	ret = route->main(route_argc(route), route->args);
+	response.route_ms = now_ms() - response.route_ms;
 
-	/*
-	 * Some data may not be written yet to the pipe.  Dumping data
-	 * now will just raise an empty string.  We need to flush both
-	 * stdout and stderr in order to dump generated content.
-	 */
-	fflush(stdout);
-	fflush(stderr);
+	if (ret != EXIT_SUCCESS) {
+		discard_body();
 
-	/*
-	 * Then, restore stdout and stderr, route output is waiting at
-	 * the read-end of the pipe "out[0]", and any error are waiting
-	 * at the read-end of the pipe "err[0]".
-	 */
-	if (dup2(stdout_save, STDOUT_FILENO) == -1)
-		error(500, "dup2(out, save): %s\n", strerror(errno));
-	if (dup2(stderr_save, STDERR_FILENO) == -1)
-		error(500, "dup2(err, save): %s\n", strerror(errno));
-	close(stdout_save);
-	close(stderr_save);
-
-	if (ret == EXIT_SUCCESS) {
-		raw_dump(err[0], stderr);
-		return dump(200, route->content_type, out[0], NULL);
+		/* Errors messages have been printed on stderr already */
+		if (ret == EXIT_NOT_FOUND)
+			print_error(404);
+		else
+			print_error(500);
+
+		return 0;
 	}
-	if (ret == EXIT_FAILURE)
-		return dump(500, NULL, err[0], stderr);
-	if (ret == EXIT_NOT_FOUND)
-		return dump(404, NULL, err[0], stderr);
 
-	return dump(500, NULL, err[0], stderr);
+	/* Buffer and its size are only valid after a flush */
+	fflush(body);
+	send_response(route->content_type, req);
+	discard_body();
+
+	return 1;
 }
 
 static int load_path_and_query(char **_path, char **_query)
@@ -405,7 +558,7 @@ static int load_path_and_query(char **_path, char **_query)
 	 * query string.
 	 */
 
-	if (!(uri = getenv("REQUEST_URI")))
+	if (!(uri = getparam("REQUEST_URI")))
 		return 0;
 
 	*_path = path;
@@ -427,9 +580,13 @@ static void init_cgi(void)
 	const char *tmp, *port = NULL;
 	int ret;
 
-	if ((tmp = getenv("SERVER_NAME")))
+	/* Don't keep values from the previous request in SCGI mode */
+	cgi_config.name = "teerank.com";
+	cgi_config.port = "80";
+
+	if ((tmp = getparam("SERVER_NAME")))
 		cgi_config.name = tmp;
-	if ((tmp = getenv("SERVER_PORT")))
+	if ((tmp = getparam("SERVER_PORT")))
 		cgi_config.port = tmp;
 
 	if (!cgi_config.name)
@@ -446,24 +603,231 @@ static void init_cgi(void)
 		error(414, "%s: Server name too long", cgi_config.name);
 }
 
-int main(int argc, char **argv)
+static void init_request(struct request *req, char *path, char *query)
 {
-	char *path, *query;
+	struct tm *tm;
 
-	/*
-	 * We want to use read only mode to prevent any security exploit
-	 * to be able to write the database.
-	 */
-	init_teerank(1);
-	init_cgi();
+	/* Absolute URLs depends on the domain, so it's part of the key */
+	snprintf(req->key, sizeof(req->key), "%s%s?%s", cgi_config.domain, path, query);
+	req->mtime = last_database_update();
+
+	snprintf(req->etag, sizeof(req->etag), "\"%lx-%x\"",
+	         (unsigned long)req->mtime, hash_string(req->key));
+
+	tm = gmtime(&req->mtime);
+	strftime(req->last_modified, sizeof(req->last_modified),
+	         "%a, %d %b %Y %H:%M:%S GMT", tm);
+}
+
+/*
+ * ETags are only sent with a 200 and depend on the URL and the database
+ * state, hence a matching one proves the page would be the same 200.
+ * "*" and If-Modified-Since don't: the page may not exist.
+ */
+enum validation {
+	MODIFIED,
+	NOT_MODIFIED,
+	NOT_MODIFIED_IF_FOUND
+};
 
-	if (argc != 1 || !load_path_and_query(&path, &query)) {
-		fprintf(stderr, "usage: %s\n", argv[0]);
-		fprintf(stderr, "This program expect $REQUEST_URI to be set.\n");
-		error(500, NULL);
+/*
+ * If-None-Match contains a list of ETag, or "*".  When present,
+ * If-Modified-Since must be ignored.
+ */
+static enum validation is_not_modified(struct request *req)
+{
+	const char *tmp;
+	struct tm tm = { 0 };
+	time_t since;
+
+	if ((tmp = getparam("HTTP_IF_NONE_MATCH"))) {
+		if (strstr(tmp, req->etag))
+			return NOT_MODIFIED;
+		if (strcmp(tmp, "*") == 0)
+			return NOT_MODIFIED_IF_FOUND;
+		return MODIFIED;
 	}
 
-	generate(do_route(path, query));
+	if (!(tmp = getparam("HTTP_IF_MODIFIED_SINCE")))
+		return MODIFIED;
+	if (!strptime(tmp, "%a, %d %b %Y %H:%M:%S GMT", &tm))
+		return MODIFIED;
 
-	return EXIT_SUCCESS;
+	/* TZ is set to UTC by init_teerank(), so mktime() works with UTC */
+	since = mktime(&tm);
+	if (since != -1 && req->mtime <= since)
+		return NOT_MODIFIED_IF_FOUND;
+	return MODIFIED;
+}
+
+/*
+ * Route the request and send the response.  Before running the route,
+ * check if the client already have it, or if it is in the cache.  The
+ * request is initialized first because do_route() does modify path and
+ * query.
+ *
+ * Unknown routes and redirects never return from do_route(), so they
+ * are never answered 304.  When the client validator doesn't prove the
+ * page exists, the route is run and 304 is only sent in place of a 200.
+ */
+static void process(char *path, char *query)
+{
+	struct request req;
+	struct route *route;
+	struct iovec iov[2];
+	char timing[64];
+	double start;
+	size_t size;
+	char *buf;
+
+	init_request(&req, path, query);
+	route = do_route(path, query);
+
+	switch (is_not_modified(&req)) {
+	case NOT_MODIFIED:
+		verbose("'%s' not modified", req.key);
+		send_not_modified(&req);
+		return;
+	case NOT_MODIFIED_IF_FOUND:
+		req.not_modified = 1;
+		break;
+	case MODIFIED:
+		req.not_modified = 0;
+		break;
+	}
+
+	start = now_ms();
+	if (*config.cache && (buf = read_cache(req.key, req.mtime, &size))) {
+		/* Only successful pages are cached */
+		if (req.not_modified) {
+			verbose("'%s' not modified", req.key);
+			send_not_modified(&req);
+			free(buf);
+			return;
+		}
+
+		verbose("Serving '%s' from cache", req.key);
+
+		/* Cached headers don't have Server-Timing, prepend it */
+		iov[0].iov_base = timing;
+		iov[0].iov_len = snprintf(
+			timing, sizeof(timing),
+			"Server-Timing: cache;dur=%.3f\n", now_ms() - start);
+		iov[1].iov_base = buf;
+		iov[1].iov_len = size;
+
+		response.status = 200;
+		send_iov(iov, 2);
+		free(buf);
+		return;
+	}
+
+	generate(route, &req);
+}
+
+/*
+ * Append a line to the access log with the request, the response
+ * status and size, how long it took in milliseconds, and how much of
+ * that time was spent in SQLite.  A single write() with O_APPEND keeps
+ * lines from different processes whole.
+ */
+static void log_request(const char *uri)
+{
+	static int fd = -1;
+	const char *method;
+	char line[2048], date[32], bytes[32];
+	time_t now;
+	int ret;
+
+	if (!*config.access_log)
+		return;
+
+	if (fd == -1) {
+		fd = open(config.access_log, O_WRONLY | O_APPEND | O_CREAT, 0644);
+		if (fd == -1) {
+			perror(config.access_log);
+			return;
+		}
+	}
+
+	if (!(method = getparam("REQUEST_METHOD")))
+		method = "-";
+
+	now = time(NULL);
+	strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%SZ", gmtime(&now));
+
+	if (response.bytes)
+		snprintf(bytes, sizeof(bytes), "%lu", (unsigned long)response.bytes);
+	else
+		snprintf(bytes, sizeof(bytes), "-");
+
+	ret = snprintf(
+		line, sizeof(line), "%s %s %s %d %s %.3f %.3f %u %u\n",
+		date, method, *uri ? uri : "-", response.status, bytes,
+		now_ms() - response.start, query_stats.ms,
+		query_stats.queries, query_stats.rows);
+
+	/* Still log truncated URIs, but keep the line ending */
+	if (ret >= sizeof(line)) {
+		ret = sizeof(line) - 1;
+		line[ret - 1] = '\n';
+	}
+
+	if (write(fd, line, ret) == -1)
+		perror(config.access_log);
+}
+
+/*
+ * Pages read derived tables, which are created by teerank-update when
+ * it first runs on a database.  Once there, they stay.
+ */
+static int derived_tables_ready(void)
+{
+	static int ready;
+
+	if (!ready)
+		ready = have_derived_tables();
+	return ready;
+}
+
+/*
+ * Serve the request described by CGI variables on stdout.  Errors and
+ * redirections are sent as well, but then 0 is returned.
+ */
+int serve_request(void)
+{
+	static char uri[1024];
+	char *path, *query, *tmp;
+
+	if (setjmp(request_env) != 0) {
+		in_request = 0;
+		log_request(uri);
+		return 0;
+	}
+
+	in_request = 1;
+
+	response.status = 0;
+	response.bytes = 0;
+	response.route_ms = 0;
+	response.start = now_ms();
+	memset(&query_stats, 0, sizeof(query_stats));
+	reset_html();
+
+	/* Path and query are parsed in place, keep the URI to log it */
+	tmp = getparam("REQUEST_URI");
+	snprintf(uri, sizeof(uri), "%s", tmp ? tmp : "");
+
+	init_cgi();
+	if (!load_path_and_query(&path, &query))
+		error(400, "$REQUEST_URI not set\n");
+
+	if (!derived_tables_ready())
+		error(503, "Database not ready yet, teerank-update must run first\n");
+
+	process(path, query);
+
+	in_request = 0;
+	log_request(uri);
+	return 1;
 }
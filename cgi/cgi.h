@@ -2,13 +2,28 @@
 #define CGI_H
 
 #include <stdlib.h>
+#include <stdarg.h>
 
 /* Used by pages */
 #define EXIT_NOT_FOUND 2
 
+/*
+ * Route the request described by CGI variables (or SCGI ones) and send
+ * the response on stdout.  Return 0 when the response is an error or a
+ * redirection sent by error() or redirect(), they don't exit() then.
+ */
+int serve_request(void);
+
 void error(int code, char *fmt, ...);
 void redirect(const char *fmt, ...);
 
+/*
+ * Pages output goes to an in-memory buffer, and is sent only once the
+ * page is fully generated.  Use html(), json() and friends instead.
+ */
+void out(const char *fmt, ...);
+void vout(const char *fmt, va_list ap);
+
 #define MAX_DOMAIN_LENGTH 1024
 
 extern struct cgi_config {
@@ -25,8 +40,14 @@ extern struct cgi_config {
 /* Parse page number (used by *-list) */
 int parse_pnum(const char *str, unsigned *pnum);
 
+/* Parse server list key "<nplayers>,<ip>,<port>" (used by server-list) */
+int parse_server_key(const char *str, unsigned *nplayers, char *ip, char *port);
+
 unsigned char hextodec(char c);
 
+/* Hash a string, used to name things after URLs */
+unsigned hash_string(const char *str);
+
 char *url_encode(const char *str);
 void url_decode(char *str);
 
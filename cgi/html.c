@@ -16,7 +16,7 @@ void html(const char *fmt, ...)
 	va_list ap;
 
 	va_start(ap, fmt);
-	vprintf(fmt, ap);
+	vout(fmt, ap);
 	va_end(ap);
 }
 
@@ -25,7 +25,7 @@ void xml(const char *fmt, ...)
 	va_list ap;
 
 	va_start(ap, fmt);
-	vprintf(fmt, ap);
+	vout(fmt, ap);
 	va_end(ap);
 }
 
@@ -34,7 +34,7 @@ void svg(const char *fmt, ...)
 	va_list ap;
 
 	va_start(ap, fmt);
-	vprintf(fmt, ap);
+	vout(fmt, ap);
 	va_end(ap);
 }
 
@@ -43,7 +43,7 @@ void css(const char *fmt, ...)
 	va_list ap;
 
 	va_start(ap, fmt);
-	vprintf(fmt, ap);
+	vout(fmt, ap);
 	va_end(ap);
 }
 
@@ -60,10 +60,10 @@ static void print(const char *fmt, va_list ap)
 	unsigned i;
 
 	for (i = 0; i < indent; i++)
-		putchar('\t');
+		out("\t");
 
-	vprintf(fmt, ap);
-	putchar('\n');
+	vout(fmt, ap);
+	out("\n");
 }
 
 static void _xml(const char *fmt, va_list ap)
@@ -154,6 +154,15 @@ const struct tab CTF_TAB = { "CTF", "/" };
 const struct tab ABOUT_TAB = { "About", "/about" };
 struct tab CUSTOM_TAB = { NULL, NULL };
 
+void reset_html(void)
+{
+#ifndef NDEBUG
+	indent = 0;
+#endif
+	CUSTOM_TAB.name = NULL;
+	CUSTOM_TAB.href = NULL;
+}
+
 char *escape(const char *str)
 {
 	static char buf[1024];
@@ -564,6 +573,8 @@ void html_start_clan_list(void)
 	html("<th></th>");
 	html("<th>Name</th>");
 	html("<th>Members</th>");
+	html("<th>Best rank</th>");
+	html("<th>Average Elo</th>");
 	html("</tr>");
 	html("</thead>");
 	html("<tbody>");
@@ -575,20 +586,29 @@ void html_end_clan_list(void)
 	html("</table>");
 }
 
-void html_clan_list_entry(
-	unsigned pos, const char *name, unsigned nmembers)
+void html_clan_list_entry(unsigned pos, struct clan *clan)
 {
-	assert(name != NULL);
+	assert(clan != NULL);
 
 	html("<tr>");
 
 	html("<td>%u</td>", pos);
 
 	/* Name */
-	html("<td><a href=\"/clan/%s\">%s</a></td>", url_encode(name), escape(name));
+	html("<td><a href=\"/clan/%s\">%s</a></td>",
+	     url_encode(clan->name), escape(clan->name));
 
 	/* Members */
-	html("<td>%u</td>", nmembers);
+	html("<td>%u</td>", clan->nmembers);
+
+	/* Best rank */
+	if (clan->best_rank != UNRANKED)
+		html("<td>%u</td>", clan->best_rank);
+	else
+		html("<td>...</td>");
+
+	/* Average elo, clans have at least one member */
+	html("<td>%d</td>", clan->total_elo / (int)clan->nmembers);
 
 	html("</tr>");
 }
@@ -714,7 +734,7 @@ static unsigned min(unsigned a, unsigned b)
 	return a < b ? a : b;
 }
 
-void print_page_nav(const char *url, unsigned pnum, unsigned npages)
+void print_page_nav(const char *url, unsigned pnum, unsigned npages, const char *next)
 {
 	/* Number of pages shown before and after the current page */
 	static const unsigned extra = 3;
@@ -755,8 +775,33 @@ void print_page_nav(const char *url, unsigned pnum, unsigned npages)
 	/* Next button */
 	if (pnum == npages)
 		html("<a class=\"next\">Next</a>");
+	else if (next)
+		html("<a class=\"next\" href=\"%s?p=%u&amp;after=%s\">Next</a>",
+		     url, pnum + 1, url_encode(next));
 	else
 		html("<a class=\"next\" href=\"%s?p=%u\">Next</a>", url, pnum + 1);
 
 	html("</nav>");
 }
+
+void print_keyset_nav(const char *url, unsigned pnum, const char *next)
+{
+	assert(url != NULL);
+
+	html("<nav class=\"pages\">");
+
+	if (pnum == 1)
+		html("<a class=\"previous\">Previous</a>");
+	else
+		html("<a class=\"previous\" href=\"%s?p=%u\">Previous</a>", url, pnum - 1);
+
+	html("<a class=\"current\">%u</a>", pnum);
+
+	if (!next)
+		html("<a class=\"next\">Next</a>");
+	else
+		html("<a class=\"next\" href=\"%s?p=%u&amp;after=%s\">Next</a>",
+		     url, pnum + 1, url_encode(next));
+
+	html("</nav>");
+}
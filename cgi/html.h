@@ -4,6 +4,7 @@
 #include <time.h>
 
 #include "player.h"
+#include "clan.h"
 
 void html(const char *fmt, ...);
 void xml(const char *fmt, ...);
@@ -32,6 +33,13 @@ struct tab {
 };
 extern const struct tab CTF_TAB, ABOUT_TAB;
 extern struct tab CUSTOM_TAB;
+
+/*
+ * Forget state left by the previous page, a page failing half way does
+ * not close its tags for instance.  Must be called before each request
+ * when a process handles many of them.
+ */
+void reset_html(void);
 void html_header(
 	const struct tab *active, const char *title,
 	const char *sprefix, const char *query);
@@ -51,8 +59,7 @@ void html_online_player_list_entry(struct player *player, struct client *client)
 /* Clan list */
 void html_start_clan_list(void);
 void html_end_clan_list(void);
-void html_clan_list_entry(
-	unsigned pos, const char *hexname, unsigned nmembers);
+void html_clan_list_entry(unsigned pos, struct clan *clan);
 
 /* Server list */
 void html_start_server_list(void);
@@ -65,6 +72,17 @@ enum section_tab {
 
 void print_section_tabs(enum section_tab tab, const char *squery, unsigned *tabvals);
 
-void print_page_nav(const char *url, unsigned pnum, unsigned npages);
+/*
+ * "next" is the sort key of the last row of the current page, or NULL
+ * when it is the last page.  When given, the next page is reached with
+ * "after" instead of an offset, see print_keyset_nav().
+ */
+void print_page_nav(const char *url, unsigned pnum, unsigned npages, const char *next);
+
+/*
+ * Navigation for pages reached with "after", the sort key of the last
+ * row of the previous page.
+ */
+void print_keyset_nav(const char *url, unsigned pnum, const char *next);
 
 #endif /* HTML_H */
@@ -1,10 +1,21 @@
 #include <stdio.h>
+#include <stdarg.h>
 #include <time.h>
 #include <assert.h>
 #include <string.h>
 
+#include "cgi.h"
 #include "json.h"
 
+void json(const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	vout(fmt, ap);
+	va_end(ap);
+}
+
 char *json_escape(const char *str)
 {
 	static char buf[1024], *c;
@@ -1,6 +1,9 @@
 #ifndef JSON_H
 #define JSON_H
 
+/* Print JSON into the response body */
+void json(const char *fmt, ...);
+
 char *json_escape(const char *string);
 char *json_date(time_t t);
 const char *json_boolean(int boolean);
@@ -0,0 +1,79 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "teerank.h"
+#include "cgi.h"
+#include "scgi.h"
+
+/*
+ * Handle one SCGI request: the connection become our stdout, so that
+ * everything works just like in CGI mode.
+ */
+static void handle_request(int fd, int devnull)
+{
+	if (dup2(fd, STDOUT_FILENO) == -1) {
+		perror("dup2(conn)");
+		close(fd);
+		return;
+	}
+	close(fd);
+
+	serve_request();
+
+	/* Send the response and close the connection */
+	fflush(stdout);
+	dup2(devnull, STDOUT_FILENO);
+}
+
+static int scgi_main(void)
+{
+	int sock, fd, devnull;
+
+	if ((sock = scgi_listen(config.scgi)) == -1)
+		return EXIT_FAILURE;
+
+	scgi_prefork(config.scgi_workers);
+
+	/*
+	 * Each worker have its own database connection, opened after
+	 * fork() since a SQLite connection can't be shared across
+	 * processes.
+	 */
+	init_teerank(1);
+
+	if ((devnull = open("/dev/null", O_WRONLY)) == -1) {
+		perror("/dev/null");
+		return EXIT_FAILURE;
+	}
+
+	while ((fd = scgi_accept(sock)) != -1)
+		handle_request(fd, devnull);
+
+	return EXIT_FAILURE;
+}
+
+int main(int argc, char **argv)
+{
+	load_config();
+	if (argc == 1 && *config.scgi)
+		return scgi_main();
+
+	/*
+	 * We want to use read only mode to prevent any security exploit
+	 * to be able to write the database.
+	 */
+	init_teerank(1);
+
+	if (argc != 1 || !getenv("REQUEST_URI")) {
+		fprintf(stderr, "usage: %s\n", argv[0]);
+		fprintf(stderr, "This program expect $REQUEST_URI to be set.\n");
+		error(500, NULL);
+	}
+
+	if (!serve_request())
+		return EXIT_FAILURE;
+
+	return EXIT_SUCCESS;
+}
@@ -201,6 +201,8 @@ int main_html_about_json_api(int argc, char **argv)
 
 	jsonurl("players/by-rank.json?p=<em>page_number</em>");
 	jsonurl("players/by-lastseen.json?p=<em>page_number</em>");
+	jsonurl("players/by-rank.json?after=<em>next</em>");
+	jsonurl("players/by-lastseen.json?after=<em>next</em>");
 
 	start_jsondesc_table();
 
@@ -219,6 +221,7 @@ int main_html_about_json_api(int argc, char **argv)
 	jsondesc_row("server_port", "string", "\"8300\"", "Port of the last server the player was playing on (can be empty)");
 	jsondesc_row("}", NULL, NULL, NULL);
 	jsondesc_row("]", NULL, NULL, NULL);
+	jsondesc_row("next", "string", "\"45678\"", "Key of the last player (rank, or lastseen and rank), to be given as <code>after</code> to get the next page (only when the page is full)");
 
 	jsondesc_row("}", NULL, NULL, NULL);
 
@@ -237,6 +240,8 @@ int main_html_about_json_api(int argc, char **argv)
 	jsondesc_row("{", NULL, NULL, NULL);
 	jsondesc_row("name", "hexstring", "\"00\"", "Clan name");
 	jsondesc_row("nmembers", "unsigned", "3", "Number of players in the clan");
+	jsondesc_row("total_elo", "integer", "4500", "Sum of members elo");
+	jsondesc_row("best_rank", "unsigned", "42", "Best rank among members, 0 when none are ranked");
 
 	jsondesc_row("members", "", "", "Array of <code>nmembers</code> players name");
 	jsondesc_row("[", NULL, NULL, NULL);
@@ -254,6 +259,7 @@ int main_html_about_json_api(int argc, char **argv)
 	html("<h1 id=\"clan-list\">Clan list</h1>");
 
 	jsonurl("clans/by-nmembers.json?p=<em>page_number</em>");
+	jsonurl("clans/by-nmembers.json?after=<em>next</em>");
 
 	start_jsondesc_table();
 
@@ -265,8 +271,11 @@ int main_html_about_json_api(int argc, char **argv)
 	jsondesc_row("{", NULL, NULL, NULL);
 	jsondesc_row("name", "hexstring", "\"00\"", "Clan name");
 	jsondesc_row("nmembers", "unsigned", "2", "Number of members");
+	jsondesc_row("total_elo", "integer", "3000", "Sum of members elo");
+	jsondesc_row("best_rank", "unsigned", "42", "Best rank among members, 0 when none are ranked");
 	jsondesc_row("}", NULL, NULL, NULL);
 	jsondesc_row("]", NULL, NULL, NULL);
+	jsondesc_row("next", "string", "\"2,clan\"", "Key of the last clan, to be given as <code>after</code> to get the next page (only when the page is full)");
 
 	jsondesc_row("}", NULL, NULL, NULL);
 
@@ -314,6 +323,7 @@ int main_html_about_json_api(int argc, char **argv)
 	html("<h1 id=\"server-list\">Server list</h1>");
 
 	jsonurl("servers/by-nplayers.json?p=<em>page_number</em>");
+	jsonurl("servers/by-nplayers.json?after=<em>next</em>");
 
 	start_jsondesc_table();
 
@@ -328,6 +338,7 @@ int main_html_about_json_api(int argc, char **argv)
 	jsondesc_row("nplayers", "unsigned", "5", "Number of players in the server");
 	jsondesc_row("maxplayers", "unsigned", "16", "Maximum number of players");
 	jsondesc_row("]", NULL, NULL, NULL);
+	jsondesc_row("next", "string", "\"5,1.2.3.4,8300\"", "Key of the last server, to be given as <code>after</code> to get the next page (only when the page is full)");
 
 	jsondesc_row("}", NULL, NULL, NULL);
 
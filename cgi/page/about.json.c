@@ -13,12 +13,12 @@
 
 static void json_master(struct master *master)
 {
-	putchar('{');
-	printf("\"node\":\"%s\",", json_escape(master->node));
-	printf("\"service\":\"%s\",", json_escape(master->node));
-	printf("\"last_seen\":\"%s\",", json_date(master->lastseen));
-	printf("\"nservers\":%u", master->nservers);
-	putchar('}');
+	json("{");
+	json("\"node\":\"%s\",", json_escape(master->node));
+	json("\"service\":\"%s\",", json_escape(master->node));
+	json("\"last_seen\":\"%s\",", json_date(master->lastseen));
+	json("\"nservers\":%u", master->nservers);
+	json("}");
 }
 
 static int json_info(void)
@@ -32,23 +32,23 @@ static int json_info(void)
 		" FROM masters"
 		" ORDER BY node";
 
-	putchar('{');
+	json("{");
 
-	printf("\"nplayers\":%u,", count_ranked_players());
-	printf("\"nclans\":%u,",   count_clans());
-	printf("\"nservers\":%u,", count_vanilla_servers());
-	printf("\"last_update\":\"%s\",", json_date(last_database_update()));
+	json("\"nplayers\":%u,", count_ranked_players());
+	json("\"nclans\":%u,",   count_clans());
+	json("\"nservers\":%u,", count_vanilla_servers());
+	json("\"last_update\":\"%s\",", json_date(last_database_update()));
 
-	printf("\"masters\":[");
+	json("\"masters\":[");
 
 	foreach_extended_master(query, &master) {
 		if (nrow)
-			putchar(',');
+			json(",");
 		json_master(&master);
 	}
 
-	printf("],\"nmasters\":%u", nrow);
-	putchar('}');
+	json("],\"nmasters\":%u", nrow);
+	json("}");
 
 	return res ? SUCCESS : FAILURE;
 }
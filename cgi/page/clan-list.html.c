@@ -13,20 +13,27 @@
 
 int main_html_clan_list(int argc, char **argv)
 {
-	unsigned pnum, offset, nrow;
+	unsigned pnum, offset, nrow, nmembers;
+	const char *name;
 	sqlite3_stmt *res;
 	struct clan clan;
+	char next[NAME_LENGTH + 16];
 
 	const char *query =
 		"SELECT" ALL_CLAN_COLUMNS
-		" FROM players"
-		" WHERE" IS_VALID_CLAN
-		" GROUP BY clan"
-		" ORDER BY nmembers DESC, clan"
+		" FROM clans"
+		" ORDER BY" SORT_BY_NMEMBERS
 		" LIMIT 100 OFFSET ?";
 
-	if (argc != 3) {
-		fprintf(stderr, "usage: %s <page_number> by-nmembers\n", argv[0]);
+	const char *after_query =
+		"SELECT" ALL_CLAN_COLUMNS
+		" FROM clans"
+		" WHERE nmembers < ? OR (nmembers = ? AND name > ?)"
+		" ORDER BY" SORT_BY_NMEMBERS
+		" LIMIT 100";
+
+	if (argc != 3 && argc != 4) {
+		fprintf(stderr, "usage: %s <page_number> by-nmembers [<after>]\n", argv[0]);
 		return EXIT_FAILURE;
 	}
 
@@ -38,22 +45,45 @@ int main_html_clan_list(int argc, char **argv)
 		return EXIT_FAILURE;
 	}
 
+	/* Key is "<nmembers>,<name>", clan name can contain commas */
+	if (argc == 4) {
+		if (sscanf(argv[3], "%u,", &nmembers) != 1 || !(name = strchr(argv[3], ',')))
+			return EXIT_NOT_FOUND;
+		name++;
+	}
+
 	html_header(&CTF_TAB, "CTF", "/clans", NULL);
 	print_section_tabs(CLANS_TAB, NULL, NULL);
 	html_start_clan_list();
 
 	offset = (pnum - 1) * 100;
-	foreach_clan(query, &clan, "u", offset)
-		html_clan_list_entry(++offset, clan.name, clan.nmembers);
+	if (argc == 3) {
+		foreach_clan(query, &clan, "u", offset)
+			html_clan_list_entry(++offset, &clan);
+	} else {
+		foreach_clan(after_query, &clan, "uus", nmembers, nmembers, name)
+			html_clan_list_entry(++offset, &clan);
+	}
 
 	if (!res)
 		return EXIT_FAILURE;
-	if (!nrow && pnum > 1)
+	if (!nrow && (pnum > 1 || argc == 4))
 		return EXIT_NOT_FOUND;
 
 	html_end_clan_list();
-	print_page_nav("/clans", pnum, count_clans() / 100 + 1);
-	html_footer("clan-list", relurl("/clans/%s.json?p=%u", argv[2], pnum));
+
+	/* Sort key of the last row, when there may be a next page */
+	if (nrow == 100)
+		snprintf(next, sizeof(next), "%u,%s", clan.nmembers, clan.name);
+
+	if (argc == 3) {
+		print_page_nav("/clans", pnum, count_clans() / 100 + 1, nrow == 100 ? next : NULL);
+		html_footer("clan-list", relurl("/clans/%s.json?p=%u", argv[2], pnum));
+		return EXIT_SUCCESS;
+	}
+
+	print_keyset_nav("/clans", pnum, nrow == 100 ? next : NULL);
+	html_footer("clan-list", relurl("/clans/%s.json?after=%s", argv[2], url_encode(argv[3])));
 
 	return EXIT_SUCCESS;
 }
@@ -2,53 +2,83 @@
 #include <stdlib.h>
 #include <limits.h>
 #include <errno.h>
+#include <string.h>
 
 #include "teerank.h"
 #include "cgi.h"
 #include "clan.h"
 #include "json.h"
 
+static void json_clan_entry(struct clan *clan, unsigned nrow)
+{
+	if (nrow)
+		json(",");
+
+	json("{");
+	json("\"name\":\"%s\",", json_hexstring(clan->name));
+	json("\"nmembers\":\"%u\",", clan->nmembers);
+	json("\"total_elo\":%d,", clan->total_elo);
+	json("\"best_rank\":%u", clan->best_rank);
+	json("}");
+}
+
 int main_json_clan_list(int argc, char **argv)
 {
-	unsigned pnum, offset, nrow;
+	unsigned pnum, offset, nrow, nmembers;
+	const char *name;
 	sqlite3_stmt *res;
 	struct clan clan;
 
 	const char *query =
 		"SELECT" ALL_CLAN_COLUMNS
-		" FROM players"
-		" WHERE" IS_VALID_CLAN
-		" GROUP BY clan"
-		" ORDER BY nmembers DESC, clan"
+		" FROM clans"
+		" ORDER BY" SORT_BY_NMEMBERS
 		" LIMIT 100 OFFSET ?";
 
-	if (argc != 3) {
-		fprintf(stderr, "usage: %s <pnum> by-nmembers\n", argv[0]);
+	const char *after_query =
+		"SELECT" ALL_CLAN_COLUMNS
+		" FROM clans"
+		" WHERE nmembers < ? OR (nmembers = ? AND name > ?)"
+		" ORDER BY" SORT_BY_NMEMBERS
+		" LIMIT 100";
+
+	if (argc != 3 && argc != 4) {
+		fprintf(stderr, "usage: %s <pnum> by-nmembers [<after>]\n", argv[0]);
 		return EXIT_FAILURE;
 	}
 
 	if (!parse_pnum(argv[1], &pnum))
 		return EXIT_NOT_FOUND;
 
+	/* Key is "<nmembers>,<name>", clan name can contain commas */
+	if (argc == 4) {
+		if (sscanf(argv[3], "%u,", &nmembers) != 1 || !(name = strchr(argv[3], ',')))
+			return EXIT_NOT_FOUND;
+		name++;
+	}
 
-	printf("{\"clans\":[");
+	json("{\"clans\":[");
 
 	offset = (pnum - 1) * 100;
-	foreach_clan(query, &clan, "u", offset) {
-		if (nrow)
-			putchar(',');
-
-		putchar('{');
-		printf("\"name\":\"%s\",", json_hexstring(clan.name));
-		printf("\"nmembers\":\"%u\"", clan.nmembers);
-		putchar('}');
+	if (argc == 3) {
+		foreach_clan(query, &clan, "u", offset)
+			json_clan_entry(&clan, nrow);
+	} else {
+		foreach_clan(after_query, &clan, "uus", nmembers, nmembers, name)
+			json_clan_entry(&clan, nrow);
 	}
 
-	printf("],\"length\":%u}", nrow);
+	json("],\"length\":%u", nrow);
+
+	/* Key to be given as "after" to get the next page */
+	if (nrow == 100)
+		json(",\"next\":\"%u,%s\"", clan.nmembers, json_escape(clan.name));
+
+	json("}");
 
 	if (!res)
 		return EXIT_FAILURE;
-	if (!nrow && pnum > 1)
+	if (!nrow && (pnum > 1 || argc == 4))
 		return EXIT_NOT_FOUND;
 
 	return EXIT_SUCCESS;
@@ -14,6 +14,12 @@ int main_json_clan(int argc, char **argv)
 	unsigned nrow;
 	sqlite3_stmt *res;
 	struct player p;
+	struct clan clan;
+
+	const char *clan_query =
+		"SELECT" ALL_CLAN_COLUMNS
+		" FROM clans"
+		" WHERE name = ?";
 
 	const char *query =
 		"SELECT" ALL_PLAYER_COLUMNS
@@ -26,15 +32,23 @@ int main_json_clan(int argc, char **argv)
 		return EXIT_FAILURE;
 	}
 
-	printf("{\"members\":[");
+	foreach_clan(clan_query, &clan, "s", argv[1]);
+	if (!res)
+		return EXIT_FAILURE;
+	if (!nrow)
+		return EXIT_NOT_FOUND;
+
+	json("{\"members\":[");
 
 	foreach_player(query, &p, "s", argv[1]) {
 		if (nrow)
-			putchar(',');
-		printf("\"%s\"", json_hexstring(p.name));
+			json(",");
+		json("\"%s\"", json_hexstring(p.name));
 	}
 
-	printf("],\"nmembers\":%u}", nrow);
+	json("],\"nmembers\":%u,", nrow);
+	json("\"total_elo\":%d,", clan.total_elo);
+	json("\"best_rank\":%u}", clan.best_rank);
 
 	if (!res)
 		return EXIT_FAILURE;
@@ -3,6 +3,7 @@
 #include <assert.h>
 #include <string.h>
 
+#include "cgi.h"
 #include "teerank.h"
 #include "html.h"
 
@@ -11,15 +12,21 @@
 struct dataset {
 	unsigned ndata;
 
+	/*
+	 * When data is a rollup, "low" and "high" are the lowest and
+	 * highest values over the period.  Otherwise they are "value".
+	 */
 	struct data {
 		time_t ts;
 		long value;
+		long low, high;
 	} data[MAX_DATA];
 
 	long min, max;
 };
 
-static void dataset_append(struct dataset *ds, time_t ts, long value)
+static void dataset_append(
+	struct dataset *ds, time_t ts, long value, long low, long high)
 {
 	struct data *data = &ds->data[ds->ndata];
 
@@ -27,40 +34,141 @@ static void dataset_append(struct dataset *ds, time_t ts, long value)
 
 	data->ts = ts;
 	data->value = value;
+	data->low = low;
+	data->high = high;
 
 	if (!ds->ndata) {
-		ds->min = value;
-		ds->max = value;
-	} else if (value > ds->max) {
-		ds->max = value;
-	} else if (value < ds->min) {
-		ds->min = value;
+		ds->min = low;
+		ds->max = high;
+	} else {
+		if (high > ds->max)
+			ds->max = high;
+		if (low < ds->min)
+			ds->min = low;
 	}
 
 	ds->ndata++;
 }
 
+/*
+ * Time ranges that can be requested, and the resolution used for each
+ * of them.  The finest resolution giving at most MAX_DATA points is
+ * used.  Without range, the latest MAX_DATA records are used.
+ */
+static const struct range {
+	const char *name;
+	time_t duration;
+	time_t resolution;
+} RANGES[] = {
+	{ "day",   24 * 3600,       HISTORIC_HOURLY },
+	{ "week",  7 * 24 * 3600,   HISTORIC_DAILY },
+	{ "month", 31 * 24 * 3600,  HISTORIC_DAILY },
+	{ "year",  365 * 24 * 3600, HISTORIC_MONTHLY },
+	{ "all",   0,               HISTORIC_MONTHLY },
+	{ NULL }
+};
+
+static const struct range *get_range(const char *name)
+{
+	const struct range *range;
+
+	for (range = RANGES; range->name; range++)
+		if (strcmp(range->name, name) == 0)
+			return range;
+
+	return NULL;
+}
+
+struct rollup {
+	struct player_record r;
+	int min_elo, max_elo;
+	unsigned min_rank, max_rank;
+};
+
+#define ALL_ROLLUP_COLUMNS \
+	ALL_PLAYER_RECORD_COLUMNS ", min_elo, max_elo, min_rank, max_rank "
+
+static void read_rollup(sqlite3_stmt *res, void *_r)
+{
+	struct rollup *r = _r;
+
+	read_player_record(res, &r->r);
+	r->min_elo = sqlite3_column_int(res, 3);
+	r->max_elo = sqlite3_column_int(res, 4);
+	r->min_rank = sqlite3_column_int64(res, 5);
+	r->max_rank = sqlite3_column_int64(res, 6);
+}
+
+static void read_record(sqlite3_stmt *res, void *_r)
+{
+	struct rollup *r = _r;
+
+	read_player_record(res, &r->r);
+	r->min_elo = r->max_elo = r->r.elo;
+	r->min_rank = r->max_rank = r->r.rank;
+}
+
+/* Records are read backward, put them back in chronological order */
+static void dataset_reverse(struct dataset *ds)
+{
+	struct data tmp;
+	unsigned i;
+
+	for (i = 0; i < ds->ndata / 2; i++) {
+		tmp = ds->data[i];
+		ds->data[i] = ds->data[ds->ndata - i - 1];
+		ds->data[ds->ndata - i - 1] = tmp;
+	}
+}
+
 static int fill_datasets(
-	struct dataset *dselo, struct dataset *dsrank, const char *pname)
+	struct dataset *dselo, struct dataset *dsrank,
+	const char *pname, const struct range *range)
 {
 	unsigned nrow;
 	sqlite3_stmt *res;
-	struct player_record r;
+	struct rollup r;
 	static const struct dataset DATASET_ZERO;
+	void (*read_row)(sqlite3_stmt*, void*);
 
 	const char *query =
 		"SELECT" ALL_PLAYER_RECORD_COLUMNS
 		" FROM player_historic"
 		" WHERE name = ?"
-		" ORDER BY timestamp"
+		" ORDER BY timestamp DESC"
+		" LIMIT ?";
+
+	/*
+	 * The range ends with the latest period the player was seen, so
+	 * that the graph is not empty for inactive players.
+	 */
+	const char *rollup_query =
+		"SELECT" ALL_ROLLUP_COLUMNS
+		" FROM player_historic_rollup"
+		" WHERE name = ? AND resolution = ?"
+		"  AND (? = 0 OR period > ("
+		"   SELECT MAX(period) FROM player_historic_rollup"
+		"   WHERE name = ? AND resolution = ?) - ?)"
+		" ORDER BY period DESC"
 		" LIMIT ?";
 
 	*dselo = DATASET_ZERO;
 	*dsrank = DATASET_ZERO;
 
-	foreach_player_record(query, &r, "si", pname, MAX_DATA) {
-		dataset_append(dselo,  r.ts, r.elo);
-		dataset_append(dsrank, r.ts, r.rank);
+	if (range) {
+		res = foreach_init(
+			rollup_query, "sttsttu", pname, range->resolution,
+			range->duration, pname, range->resolution,
+			range->duration, MAX_DATA);
+		read_row = read_rollup;
+	} else {
+		res = foreach_init(query, "su", pname, MAX_DATA);
+		read_row = read_record;
+	}
+
+	for (nrow = 0; foreach_next(&res, &r, read_row); nrow++) {
+		dataset_append(dselo, r.r.ts, r.r.elo, r.min_elo, r.max_elo);
+		dataset_append(dsrank, r.r.ts, r.r.rank, r.min_rank, r.max_rank);
 	}
 
 	if (!res)
@@ -68,6 +176,9 @@ static int fill_datasets(
 	if (!nrow)
 		return NOT_FOUND;
 
+	dataset_reverse(dselo);
+	dataset_reverse(dsrank);
+
 	return SUCCESS;
 }
 
@@ -396,6 +507,45 @@ static void print_path(struct graph *graph, struct curve *curve)
 	svg("</svg>");
 }
 
+/*
+ * Fill the area between the lowest and highest values of each period,
+ * when the curve is made of rollups.
+ */
+static void print_band(struct graph *graph, struct curve *curve)
+{
+	struct dataset *ds = curve->ds;
+	float x;
+	unsigned i;
+
+	assert(curve != NULL);
+
+	if (ds->ndata < 2)
+		return;
+
+	for (i = 0; i < ds->ndata; i++)
+		if (ds->data[i].low != ds->data[i].high)
+			break;
+	if (i == ds->ndata)
+		return;
+
+	svg("<!-- Band -->");
+	svg("<svg viewBox=\"0 0 100 100\" preserveAspectRatio=\"none\">");
+	svg("<path style=\"fill: %s; fill-opacity: 0.2; stroke: none;\" d=\"", curve->color);
+
+	for (i = 0; i < ds->ndata; i++) {
+		x = x_coord(graph, curve, &ds->data[i]);
+		svg("%c %.1f %.1f", i ? 'L' : 'M',
+		    x, y_coord(graph, curve, ds->data[i].high));
+	}
+	while (i--) {
+		x = x_coord(graph, curve, &ds->data[i]);
+		svg("L %.1f %.1f", x, y_coord(graph, curve, ds->data[i].low));
+	}
+
+	svg("Z\"/>");
+	svg("</svg>");
+}
+
 static const char *point_label_pos(
 	struct graph *graph, struct curve *curve,
 	struct data *data, struct point p)
@@ -635,6 +785,7 @@ static void print_name(struct graph *graph, struct curve *curve)
 
 static void print_curve(struct graph *graph, struct curve *curve)
 {
+	print_band(graph, curve);
 	print_path(graph, curve);
 	svg("");
 	print_points(graph, curve);
@@ -779,13 +930,17 @@ int main_svg_graph(int argc, char **argv)
 {
 	struct graph graph = { 0 };
 	struct dataset dselo, dsrank;
+	const struct range *range = NULL;
 
-	if (argc != 2) {
-		fprintf(stderr, "Usage: %s <player_name>\n", argv[0]);
+	if (argc != 2 && argc != 3) {
+		fprintf(stderr, "Usage: %s <player_name> [day|week|month|year|all]\n", argv[0]);
 		return EXIT_FAILURE;
 	}
 
-	fill_datasets(&dselo, &dsrank, argv[1]);
+	if (argc == 3 && argv[2] && !(range = get_range(argv[2])))
+		return EXIT_NOT_FOUND;
+
+	fill_datasets(&dselo, &dsrank, argv[1], range);
 
 	add_curve(&graph, &dselo, 0, "#970", "#725800", "Elo");
 	add_curve(&graph, &dsrank, 1, "#aaa", "#888", "Rank");
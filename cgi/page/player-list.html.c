@@ -13,31 +13,54 @@
 #include "player.h"
 
 static const struct order {
-	char *sortby, *urlprefix;
+	char *urlprefix;
 } BY_RANK = {
-	SORT_BY_RANK, "/players"
+	"/players"
 }, BY_LASTSEEN = {
-	SORT_BY_LASTSEEN, "/players/by-lastseen"
+	"/players/by-lastseen"
 };
 
+/*
+ * Ranks are dense, so any page of the rank ordered list is reached by
+ * seeking in the rank index instead of skipping rows with OFFSET.  The
+ * lastseen ordered list can't do that with a page number, but it can
+ * when given the key of the last row of the previous page ("after").
+ */
 int main_html_player_list(int argc, char **argv)
 {
 	const struct order *order;
-	unsigned pnum, offset;
+	unsigned pnum, rank;
+	long lastseen;
 	struct player p;
+	char next[64];
 
 	struct sqlite3_stmt *res;
 	unsigned nrow;
 
-	char query[512], *queryfmt =
+	const char *byrank =
+		"SELECT" ALL_PLAYER_COLUMNS
+		" FROM players"
+		" WHERE rank > ?"
+		" ORDER BY" SORT_BY_RANK
+		" LIMIT 100";
+
+	const char *bylastseen =
+		"SELECT" ALL_PLAYER_COLUMNS
+		" FROM players"
+		" WHERE" IS_PLAYER_RANKED
+		" ORDER BY" SORT_BY_LASTSEEN
+		" LIMIT 100 OFFSET ?";
+
+	const char *bylastseen_after =
 		"SELECT" ALL_PLAYER_COLUMNS
 		" FROM players"
 		" WHERE" IS_PLAYER_RANKED
-		" ORDER BY %s"
-		" LIMIT 100 OFFSET %u";
+		" AND (lastseen, rank) < (?, ?)"
+		" ORDER BY" SORT_BY_LASTSEEN
+		" LIMIT 100";
 
-	if (argc != 3) {
-		fprintf(stderr, "usage: %s <page_number> by-rank|by-lastseen\n", argv[0]);
+	if (argc != 3 && argc != 4) {
+		fprintf(stderr, "usage: %s <page_number> by-rank|by-lastseen [<after>]\n", argv[0]);
 		return EXIT_FAILURE;
 	}
 
@@ -53,6 +76,13 @@ int main_html_player_list(int argc, char **argv)
 		return EXIT_FAILURE;
 	}
 
+	if (argc == 4) {
+		if (order == &BY_RANK && sscanf(argv[3], "%u", &rank) != 1)
+			return EXIT_NOT_FOUND;
+		if (order == &BY_LASTSEEN && sscanf(argv[3], "%ld,%u", &lastseen, &rank) != 2)
+			return EXIT_NOT_FOUND;
+	}
+
 	html_header(&CTF_TAB, "CTF", "/players", NULL);
 	print_section_tabs(PLAYERS_TAB, NULL, NULL);
 
@@ -61,20 +91,40 @@ int main_html_player_list(int argc, char **argv)
 	else
 		html_start_player_list(0, 1, pnum);
 
-	offset = (pnum - 1) * 100;
-	snprintf(query, sizeof(query), queryfmt, order->sortby, offset);
-
-	foreach_player(query, &p)
-		html_player_list_entry(&p, NULL, 0);
+	if (order == &BY_RANK) {
+		if (argc == 3)
+			rank = (pnum - 1) * 100;
+		foreach_player(byrank, &p, "u", rank)
+			html_player_list_entry(&p, NULL, 0);
+	} else if (argc == 3) {
+		foreach_player(bylastseen, &p, "u", (pnum - 1) * 100)
+			html_player_list_entry(&p, NULL, 0);
+	} else {
+		foreach_player(bylastseen_after, &p, "tu", (time_t)lastseen, rank)
+			html_player_list_entry(&p, NULL, 0);
+	}
 
 	if (!res)
 		return EXIT_FAILURE;
-	if (!nrow && pnum > 1)
+	if (!nrow && (pnum > 1 || argc == 4))
 		return EXIT_NOT_FOUND;
 
 	html_end_player_list();
-	print_page_nav(order->urlprefix, pnum, count_ranked_players() / 100 + 1);
-	html_footer("player-list", relurl("/players/%s.json?p=%u", argv[2], pnum));
+
+	/* Sort key of the last row, when there may be a next page */
+	if (nrow == 100 && order == &BY_RANK)
+		snprintf(next, sizeof(next), "%u", p.rank);
+	else if (nrow == 100)
+		snprintf(next, sizeof(next), "%ld,%u", (long)p.lastseen, p.rank);
+
+	if (argc == 3) {
+		print_page_nav(order->urlprefix, pnum, count_ranked_players() / 100 + 1, nrow == 100 ? next : NULL);
+		html_footer("player-list", relurl("/players/%s.json?p=%u", argv[2], pnum));
+		return EXIT_SUCCESS;
+	}
+
+	print_keyset_nav(order->urlprefix, pnum, nrow == 100 ? next : NULL);
+	html_footer("player-list", relurl("/players/%s.json?after=%s", argv[2], url_encode(argv[3])));
 
 	return EXIT_SUCCESS;
 }
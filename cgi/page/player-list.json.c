@@ -11,34 +11,57 @@
 
 static void json_player(struct player *player)
 {
-	putchar('{');
-	printf("\"name\":\"%s\",", json_hexstring(player->name));
-	printf("\"clan\":\"%s\",", json_hexstring(player->clan));
-	printf("\"elo\":%d,", player->elo);
-	printf("\"rank\":%u,", player->rank);
-	printf("\"lastseen\":\"%s\",", json_date(player->lastseen));
-	printf("\"server_ip\":\"%s\",", player->server_ip);
-	printf("\"server_port\":\"%s\"", player->server_port);
-	putchar('}');
+	json("{");
+	json("\"name\":\"%s\",", json_hexstring(player->name));
+	json("\"clan\":\"%s\",", json_hexstring(player->clan));
+	json("\"elo\":%d,", player->elo);
+	json("\"rank\":%u,", player->rank);
+	json("\"lastseen\":\"%s\",", json_date(player->lastseen));
+	json("\"server_ip\":\"%s\",", player->server_ip);
+	json("\"server_port\":\"%s\"", player->server_port);
+	json("}");
+}
+
+static void json_player_entry(struct player *player, unsigned nrow)
+{
+	if (nrow)
+		json(",");
+
+	json_player(player);
 }
 
 int main_json_player_list(int argc, char **argv)
 {
-	unsigned nrow, offset;
+	unsigned nrow, pnum, rank;
 	sqlite3_stmt *res;
-	const char *sortby;
-	unsigned pnum;
+	long lastseen;
+	int byrank;
 	struct player p;
 
-	char query[512], *queryfmt =
+	const char *byrank_query =
+		"SELECT" ALL_PLAYER_COLUMNS
+		" FROM players"
+		" WHERE rank > ?"
+		" ORDER BY" SORT_BY_RANK
+		" LIMIT 100";
+
+	const char *bylastseen_query =
 		"SELECT" ALL_PLAYER_COLUMNS
 		" FROM players"
 		" WHERE" IS_PLAYER_RANKED
-		" ORDER BY %s"
-		" LIMIT 100 OFFSET %u";
+		" ORDER BY" SORT_BY_LASTSEEN
+		" LIMIT 100 OFFSET ?";
 
-	if (argc != 3) {
-		fprintf(stderr, "usage: %s <page_number> by-rank|by-lastseen\n", argv[0]);
+	const char *bylastseen_after_query =
+		"SELECT" ALL_PLAYER_COLUMNS
+		" FROM players"
+		" WHERE" IS_PLAYER_RANKED
+		" AND (lastseen, rank) < (?, ?)"
+		" ORDER BY" SORT_BY_LASTSEEN
+		" LIMIT 100";
+
+	if (argc != 3 && argc != 4) {
+		fprintf(stderr, "usage: %s <page_number> by-rank|by-lastseen [<after>]\n", argv[0]);
 		return EXIT_FAILURE;
 	}
 
@@ -46,29 +69,52 @@ int main_json_player_list(int argc, char **argv)
 		return EXIT_NOT_FOUND;
 
 	if (strcmp(argv[2], "by-rank") == 0) {
-		sortby = SORT_BY_RANK;
+		byrank = 1;
 
 	} else if (strcmp(argv[2], "by-lastseen") == 0) {
-		sortby = SORT_BY_LASTSEEN;
+		byrank = 0;
 
 	} else {
 		fprintf(stderr, "%s: Should be either \"by-rank\" or \"by-lastseen\"\n", argv[2]);
 		return EXIT_FAILURE;
 	}
 
-	offset = (pnum - 1) * 100;
-	snprintf(query, sizeof(query), queryfmt, sortby, offset);
+	if (argc == 4) {
+		if (byrank && sscanf(argv[3], "%u", &rank) != 1)
+			return EXIT_NOT_FOUND;
+		if (!byrank && sscanf(argv[3], "%ld,%u", &lastseen, &rank) != 2)
+			return EXIT_NOT_FOUND;
+	}
+
+	json("{\"players\":[");
 
-	printf("{\"players\":[");
+	if (byrank) {
+		if (argc == 3)
+			rank = (pnum - 1) * 100;
+		foreach_player(byrank_query, &p, "u", rank)
+			json_player_entry(&p, nrow);
+	} else if (argc == 3) {
+		foreach_player(bylastseen_query, &p, "u", (pnum - 1) * 100)
+			json_player_entry(&p, nrow);
+	} else {
+		foreach_player(bylastseen_after_query, &p, "tu", (time_t)lastseen, rank)
+			json_player_entry(&p, nrow);
+	}
+
+	if (!res)
+		return EXIT_FAILURE;
 
-	foreach_player(query, &p) {
-		if (nrow)
-			putchar(',');
+	json("],\"length\":%u", nrow);
 
-		json_player(&p);
+	/* Key to be given as "after" to get the next page */
+	if (nrow == 100) {
+		if (byrank)
+			json(",\"next\":\"%u\"", p.rank);
+		else
+			json(",\"next\":\"%ld,%u\"", (long)p.lastseen, p.rank);
 	}
 
-	printf("],\"length\":%u}", nrow);
+	json("}");
 
 	return EXIT_SUCCESS;
 }
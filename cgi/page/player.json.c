@@ -12,13 +12,13 @@
 
 static void json_player(struct player *player)
 {
-	printf("\"name\":\"%s\",", json_hexstring(player->name));
-	printf("\"clan\":\"%s\",", json_hexstring(player->clan));
-	printf("\"elo\":%d,", player->elo);
-	printf("\"rank\":%u,", player->rank);
-	printf("\"lastseen\":\"%s\",", json_date(player->lastseen));
-	printf("\"server_ip\":\"%s\",", player->server_ip);
-	printf("\"server_port\":\"%s\"", player->server_port);
+	json("\"name\":\"%s\",", json_hexstring(player->name));
+	json("\"clan\":\"%s\",", json_hexstring(player->clan));
+	json("\"elo\":%d,", player->elo);
+	json("\"rank\":%u,", player->rank);
+	json("\"lastseen\":\"%s\",", json_date(player->lastseen));
+	json("\"server_ip\":\"%s\",", player->server_ip);
+	json("\"server_port\":\"%s\"", player->server_port);
 }
 
 static int json_player_historic(const char *pname)
@@ -34,18 +34,18 @@ static int json_player_historic(const char *pname)
 		" WHERE name = ?"
 		" ORDER BY timestamp";
 
-	printf(",\"historic\":{\"records\":[");
+	json(",\"historic\":{\"records\":[");
 
 	foreach_player_record(query, &r, "s", pname) {
 		if (!nrow)
 			epoch = r.ts;
 		else
-			putchar(',');
+			json(",");
 
-		printf("[%ju, %d, %u]", (uintmax_t)(r.ts - epoch), r.elo, r.rank);
+		json("[%ju, %d, %u]", (uintmax_t)(r.ts - epoch), r.elo, r.rank);
 	}
 
-	printf("],\"epoch\":%ju,\"length\":%u}", (uintmax_t)epoch, nrow);
+	json("],\"epoch\":%ju,\"length\":%u}", (uintmax_t)epoch, nrow);
 
 	return res != NULL;
 }
@@ -83,13 +83,13 @@ int main_json_player(int argc, char **argv)
 	if (!nrow)
 		return EXIT_NOT_FOUND;
 
-	putchar('{');
+	json("{");
 
 	json_player(&player);
 	if (full && !json_player_historic(player.name))
 		return EXIT_FAILURE;
 
-	putchar('}');
+	json("}");
 
 	return EXIT_SUCCESS;
 }
@@ -5,6 +5,6 @@
 
 int main_txt_robots(int argc, char **argv)
 {
-	printf("Sitemap: http://%s/sitemap.xml\n", cgi_config.domain);
+	out("Sitemap: http://%s/sitemap.xml\n", cgi_config.domain);
 	return EXIT_SUCCESS;
 }
@@ -29,19 +29,27 @@ static void print_player(unsigned pos, void *data)
 static void print_clan(unsigned pos, void *data)
 {
 	struct clan *clan = data;
-	html_clan_list_entry(pos, clan->name, clan->nmembers);
+	html_clan_list_entry(pos, clan);
 }
 static void print_server(unsigned pos, void *data)
 {
 	html_server_list_entry(pos, data);
 }
 
+/*
+ * Substring search goes through trigram indices ("players_search" and
+ * "servers_search") sharing rowids with the table they index, instead
+ * of scanning the whole table with LIKE.
+ */
+#define IS_RELEVANT(index, col) \
+	" rowid IN (" \
+	"  SELECT rowid FROM " index \
+	"  WHERE " col " LIKE '%' || ? || '%') "
+
 /*
  * The following compute the relevance of a string in a query, using the
  * following prioprities: exact match, prefix, suffix, anything else.
  */
-#define IS_RELEVANT(col) \
-	" " col " LIKE '%' || ? || '%' "
 #define RELEVANCE(col) \
 	" CASE" \
 	"  WHEN " col " LIKE ? THEN 0" \
@@ -75,13 +83,13 @@ static const struct search_info PLAYER_SINFO = {
 	"/players",
 
 	"SELECT COUNT(1)"
-	" FROM players"
-	" WHERE" IS_RELEVANT("name")
+	" FROM players_search"
+	" WHERE name LIKE '%' || ? || '%'"
 	" LIMIT ?",
 
 	"SELECT" ALL_PLAYER_COLUMNS
 	" FROM players"
-	" WHERE" IS_RELEVANT("name")
+	" WHERE" IS_RELEVANT("players_search", "name")
 	" ORDER BY" RELEVANCE("name") ", elo"
 	" LIMIT ?"
 };
@@ -97,15 +105,16 @@ static const struct search_info CLAN_SINFO = {
 	"/clans",
 
 	"SELECT COUNT(DISTINCT clan)"
-	" FROM players"
-	" WHERE" IS_VALID_CLAN "AND" IS_RELEVANT("clan")
+	" FROM players_search"
+	" WHERE clan LIKE '%' || ? || '%' AND" IS_VALID_CLAN
 	" LIMIT ?",
 
-	"SELECT clan, COUNT(1) AS nmembers"
-	" FROM players"
-	" WHERE" IS_VALID_CLAN "AND" IS_RELEVANT("clan")
-	" GROUP BY clan"
-	" ORDER BY" RELEVANCE("clan") ", nmembers"
+	"SELECT" ALL_CLAN_COLUMNS
+	" FROM clans"
+	" WHERE name IN ("
+	"  SELECT clan FROM players_search"
+	"  WHERE clan LIKE '%' || ? || '%')"
+	" ORDER BY" RELEVANCE("name") ", nmembers"
 	" LIMIT ?"
 };
 
@@ -121,12 +130,12 @@ static const struct search_info SERVER_SINFO = {
 
 	"SELECT COUNT(1)"
 	" FROM servers"
-	" WHERE" IS_VANILLA_CTF_SERVER "AND" IS_RELEVANT("name")
+	" WHERE" IS_VANILLA_CTF_SERVER "AND" IS_RELEVANT("servers_search", "name")
 	" LIMIT ?",
 
 	"SELECT" ALL_EXTENDED_SERVER_COLUMNS
 	" FROM servers"
-	" WHERE" IS_VANILLA_CTF_SERVER "AND" IS_RELEVANT("name")
+	" WHERE" IS_VANILLA_CTF_SERVER "AND" IS_RELEVANT("servers_search", "name")
 	" ORDER BY" RELEVANCE("name") ", num_clients"
 	" LIMIT ?"
 };
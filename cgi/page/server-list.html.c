@@ -14,18 +14,29 @@
 int main_html_server_list(int argc, char **argv)
 {
 	struct server server;
-	unsigned pnum, offset, nrow;
+	unsigned pnum, offset, nrow, nplayers;
+	char ip[IP_STRSIZE], port[PORT_STRSIZE];
+	char next[64];
 	sqlite3_stmt *res;
 
 	const char *query =
 		"SELECT" ALL_EXTENDED_SERVER_COLUMNS
 		" FROM servers"
 		" WHERE" IS_VANILLA_CTF_SERVER
-		" ORDER BY num_clients DESC"
+		" ORDER BY" SORT_BY_NUM_CLIENTS
 		" LIMIT 100 OFFSET ?";
 
-	if (argc != 3) {
-		fprintf(stderr, "usage: %s <page_number> by-nplayers\n", argv[0]);
+	const char *after_query =
+		"SELECT" ALL_EXTENDED_SERVER_COLUMNS
+		" FROM servers"
+		" WHERE" IS_VANILLA_CTF_SERVER
+		" AND num_clients <= ?"
+		" AND (num_clients < ? OR (ip, port) > (?, ?))"
+		" ORDER BY" SORT_BY_NUM_CLIENTS
+		" LIMIT 100";
+
+	if (argc != 3 && argc != 4) {
+		fprintf(stderr, "usage: %s <page_number> by-nplayers [<after>]\n", argv[0]);
 		return EXIT_FAILURE;
 	}
 
@@ -37,24 +48,43 @@ int main_html_server_list(int argc, char **argv)
 		return EXIT_FAILURE;
 	}
 
+	/* Key is "<nplayers>,<ip>,<port>" */
+	if (argc == 4 && !parse_server_key(argv[3], &nplayers, ip, port))
+		return EXIT_NOT_FOUND;
+
 	html_header(&CTF_TAB, "CTF", "/servers", NULL);
 	print_section_tabs(SERVERS_TAB, NULL, NULL);
 
 	html_start_server_list();
 
 	offset = (pnum - 1) * 100;
-	foreach_extended_server(query, &server, "u", offset)
-		html_server_list_entry(++offset, &server);
+	if (argc == 3) {
+		foreach_extended_server(query, &server, "u", offset)
+			html_server_list_entry(++offset, &server);
+	} else {
+		foreach_extended_server(after_query, &server, "uuss", nplayers, nplayers, ip, port)
+			html_server_list_entry(++offset, &server);
+	}
 
 	html_end_server_list();
 
 	if (!res)
 		return EXIT_FAILURE;
-	if (!nrow && pnum > 1)
+	if (!nrow && (pnum > 1 || argc == 4))
 		return EXIT_NOT_FOUND;
 
-	print_page_nav("/servers", pnum, count_vanilla_servers() / 100 + 1);
-	html_footer("server-list", relurl("/servers/%s.json?p=%u", argv[2], pnum));
+	/* Sort key of the last row, when there may be a next page */
+	if (nrow == 100)
+		snprintf(next, sizeof(next), "%d,%s,%s", server.num_clients, server.ip, server.port);
+
+	if (argc == 3) {
+		print_page_nav("/servers", pnum, count_vanilla_servers() / 100 + 1, nrow == 100 ? next : NULL);
+		html_footer("server-list", relurl("/servers/%s.json?p=%u", argv[2], pnum));
+		return EXIT_SUCCESS;
+	}
+
+	print_keyset_nav("/servers", pnum, nrow == 100 ? next : NULL);
+	html_footer("server-list", relurl("/servers/%s.json?after=%s", argv[2], url_encode(argv[3])));
 
 	return EXIT_SUCCESS;
 }
@@ -10,21 +10,30 @@
 
 static void json_server(struct server *server)
 {
-	putchar('{');
-	printf("\"ip\":\"%s\",", server->ip);
-	printf("\"port\":\"%s\",", server->port);
-	printf("\"name\":\"%s\",", json_escape(server->name));
-	printf("\"gametype\":\"%s\",", json_escape(server->gametype));
-	printf("\"map\":\"%s\",", json_escape(server->map));
-
-	printf("\"maxplayers\":%u,", server->max_clients);
-	printf("\"nplayers\":%u", server->num_clients);
-	putchar('}');
+	json("{");
+	json("\"ip\":\"%s\",", server->ip);
+	json("\"port\":\"%s\",", server->port);
+	json("\"name\":\"%s\",", json_escape(server->name));
+	json("\"gametype\":\"%s\",", json_escape(server->gametype));
+	json("\"map\":\"%s\",", json_escape(server->map));
+
+	json("\"maxplayers\":%u,", server->max_clients);
+	json("\"nplayers\":%u", server->num_clients);
+	json("}");
+}
+
+static void json_server_entry(struct server *server, unsigned nrow)
+{
+	if (nrow)
+		json(",");
+
+	json_server(server);
 }
 
 int main_json_server_list(int argc, char **argv)
 {
-	unsigned nrow, pnum, offset;
+	unsigned nrow, pnum, offset, nplayers;
+	char ip[IP_STRSIZE], port[PORT_STRSIZE];
 	sqlite3_stmt *res;
 	struct server server;
 
@@ -32,32 +41,53 @@ int main_json_server_list(int argc, char **argv)
 		"SELECT" ALL_EXTENDED_SERVER_COLUMNS
 		" FROM servers"
 		" WHERE" IS_VANILLA_CTF_SERVER
-		" ORDER BY num_clients DESC"
+		" ORDER BY" SORT_BY_NUM_CLIENTS
 		" LIMIT 100 OFFSET ?";
 
-	if (argc != 3) {
-		fprintf(stderr, "usage: %s <pnum> by-nplayers\n", argv[0]);
+	const char *after_query =
+		"SELECT" ALL_EXTENDED_SERVER_COLUMNS
+		" FROM servers"
+		" WHERE" IS_VANILLA_CTF_SERVER
+		" AND num_clients <= ?"
+		" AND (num_clients < ? OR (ip, port) > (?, ?))"
+		" ORDER BY" SORT_BY_NUM_CLIENTS
+		" LIMIT 100";
+
+	if (argc != 3 && argc != 4) {
+		fprintf(stderr, "usage: %s <pnum> by-nplayers [<after>]\n", argv[0]);
 		return EXIT_FAILURE;
 	}
 
 	if (!parse_pnum(argv[1], &pnum))
 		return EXIT_NOT_FOUND;
 
+	/* Key is "<nplayers>,<ip>,<port>" */
+	if (argc == 4 && !parse_server_key(argv[3], &nplayers, ip, port))
+		return EXIT_NOT_FOUND;
+
 	offset = (pnum - 1) * 100;
 
-	printf("{\"servers\":[");
+	json("{\"servers\":[");
 
-	foreach_extended_server(query, &server, "u", offset) {
-		if (nrow)
-			putchar(',');
-		json_server(&server);
+	if (argc == 3) {
+		foreach_extended_server(query, &server, "u", offset)
+			json_server_entry(&server, nrow);
+	} else {
+		foreach_extended_server(after_query, &server, "uuss", nplayers, nplayers, ip, port)
+			json_server_entry(&server, nrow);
 	}
 
-	printf("],\"length\":%u}", nrow);
+	json("],\"length\":%u", nrow);
+
+	/* Key to be given as "after" to get the next page */
+	if (nrow == 100)
+		json(",\"next\":\"%d,%s,%s\"", server.num_clients, server.ip, server.port);
+
+	json("}");
 
 	if (!res)
 		return EXIT_FAILURE;
-	if (!nrow && pnum > 1)
+	if (!nrow && (pnum > 1 || argc == 4))
 		return EXIT_NOT_FOUND;
 
 	return EXIT_SUCCESS;
@@ -20,36 +20,36 @@ static void json_server(struct server *server)
 		" WHERE ip = ? AND port = ?"
 		" ORDER BY" SORT_BY_SCORE;
 
-	putchar('{');
-	printf("\"ip\":\"%s\",", server->ip);
-	printf("\"port\":\"%s\",", server->port);
+	json("{");
+	json("\"ip\":\"%s\",", server->ip);
+	json("\"port\":\"%s\",", server->port);
 
-	printf("\"name\":\"%s\",", json_escape(server->name));
-	printf("\"gametype\":\"%s\",", json_escape(server->gametype));
-	printf("\"map\":\"%s\",", json_escape(server->map));
+	json("\"name\":\"%s\",", json_escape(server->name));
+	json("\"gametype\":\"%s\",", json_escape(server->gametype));
+	json("\"map\":\"%s\",", json_escape(server->map));
 
-	printf("\"lastseen\":\"%s\",", json_date(server->lastseen));
-	printf("\"expire\":\"%s\",", json_date(server->expire));
+	json("\"lastseen\":\"%s\",", json_date(server->lastseen));
+	json("\"expire\":\"%s\",", json_date(server->expire));
 
-	printf("\"num_clients\":%d,", server->num_clients);
-	printf("\"max_clients\":%d,", server->max_clients);
+	json("\"num_clients\":%d,", server->num_clients);
+	json("\"max_clients\":%d,", server->max_clients);
 
-	printf("\"clients\":[");
+	json("\"clients\":[");
 
 	foreach_server_client(query, &c, "ss", server->ip, server->port) {
 		if (nrow)
-			putchar(',');
-
-		putchar('{');
-		printf("\"name\":\"%s\",", json_hexstring(c.name));
-		printf("\"clan\":\"%s\",", json_hexstring(c.clan));
-		printf("\"score\":%d,", c.score);
-		printf("\"ingame\":%s", json_boolean(c.ingame));
-		putchar('}');
+			json(",");
+
+		json("{");
+		json("\"name\":\"%s\",", json_hexstring(c.name));
+		json("\"clan\":\"%s\",", json_hexstring(c.clan));
+		json("\"score\":%d,", c.score);
+		json("\"ingame\":%s", json_boolean(c.ingame));
+		json("}");
 	}
-	putchar(']');
+	json("]");
 
-	putchar('}');
+	json("}");
 }
 
 int main_json_server(int argc, char **argv)
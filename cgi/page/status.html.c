@@ -1,11 +1,14 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <assert.h>
+#include <string.h>
+#include <sys/stat.h>
 
 #include "cgi.h"
 #include "teerank.h"
 #include "html.h"
 #include "master.h"
+#include "stats.h"
 
 enum {
 	STATUS_OK,
@@ -107,6 +110,139 @@ static int show_masters_status(int teerank_stopped)
 	return 0;
 }
 
+static void show_ranks_status(int teerank_stopped)
+{
+	const char *title = "Ranks";
+	char buf[16], comment[64];
+	struct stats stats;
+
+	if (!read_stats(&stats) || teerank_stopped) {
+		print_status(title, NULL, STATUS_UNKNOWN);
+
+	} else if (stats.last_ranks_update == NEVER_SEEN) {
+		print_status(title, "Never computed", STATUS_UNKNOWN);
+
+	} else if (elapsed_time(stats.last_ranks_update, NULL, buf, sizeof(buf))) {
+		snprintf(comment, sizeof(comment), "Not updated since %s", buf);
+		print_status(title, comment, STATUS_STOPPED);
+
+	} else {
+		snprintf(
+			comment, sizeof(comment), "%u players in %ums",
+			stats.nplayers, stats.ranks_update_duration);
+		print_status(title, comment, STATUS_OK);
+	}
+}
+
+/*
+ * Metrics are written by teerank-update in the Prometheus text format,
+ * we only look for "name value" lines.
+ */
+static int get_metric(const char *metrics, const char *name, double *value)
+{
+	size_t len = strlen(name);
+	const char *line = metrics;
+
+	while (line) {
+		if (strncmp(line, name, len) == 0 && line[len] == ' ') {
+			*value = strtod(line + len + 1, NULL);
+			return 1;
+		}
+		if ((line = strchr(line, '\n')))
+			line++;
+	}
+
+	return 0;
+}
+
+/* Average of the given histogram, zero when nothing was observed */
+static double get_average(const char *metrics, const char *name)
+{
+	char buf[128];
+	double sum, count;
+
+	snprintf(buf, sizeof(buf), "%s_sum", name);
+	if (!get_metric(metrics, buf, &sum))
+		return 0;
+
+	snprintf(buf, sizeof(buf), "%s_count", name);
+	if (!get_metric(metrics, buf, &count) || !count)
+		return 0;
+
+	return sum / count;
+}
+
+static void show_update_status(int teerank_stopped)
+{
+	static char metrics[32768];
+	char buf[16], comment[128];
+	double sent = 0, received = 0, failed = 0, pending = 0, window = 0;
+	struct stat st;
+	size_t len;
+	FILE *file;
+
+	html("<h2>Update</h2>");
+
+	if (!*config.metrics) {
+		print_status("Metrics", NULL, STATUS_DISABLED);
+		return;
+	}
+
+	if (!(file = fopen(config.metrics, "r"))) {
+		print_status("Metrics", NULL, STATUS_UNKNOWN);
+		return;
+	}
+
+	len = fread(metrics, 1, sizeof(metrics) - 1, file);
+	metrics[len] = '\0';
+
+	if (fstat(fileno(file), &st) == -1 || teerank_stopped) {
+		fclose(file);
+		print_status("Metrics", NULL, STATUS_UNKNOWN);
+		return;
+	}
+	fclose(file);
+
+	if (elapsed_time(st.st_mtime, NULL, buf, sizeof(buf))) {
+		snprintf(comment, sizeof(comment), "Not updated since %s", buf);
+		print_status("Metrics", comment, STATUS_STOPPED);
+		return;
+	}
+
+	get_metric(metrics, "teerank_update_packets_sent_total", &sent);
+	get_metric(metrics, "teerank_update_packets_received_total", &received);
+	get_metric(metrics, "teerank_update_requests_failed_total", &failed);
+	snprintf(
+		comment, sizeof(comment), "%.0f sent, %.0f answers, %.0f failed",
+		sent, received, failed);
+	print_status("Requests", comment, STATUS_OK);
+
+	get_metric(metrics, "teerank_update_pending", &pending);
+	get_metric(metrics, "teerank_update_window", &window);
+	snprintf(
+		comment, sizeof(comment), "%.0f pending, window of %.0f",
+		pending, window);
+	print_status("Pool", comment, STATUS_OK);
+
+	snprintf(
+		comment, sizeof(comment), "%.1fs on average",
+		get_average(metrics, "teerank_update_sweep_seconds"));
+	print_status("Sweeps", comment, STATUS_OK);
+
+	snprintf(
+		comment, sizeof(comment), "%.0fms on average",
+		1000 * get_average(metrics, "teerank_update_scheduler_lag_seconds"));
+	print_status("Scheduler lag", comment, STATUS_OK);
+
+	snprintf(
+		comment, sizeof(comment),
+		"%.1fms, %.0f statements, %.0f rows on average",
+		1000 * get_average(metrics, "teerank_update_transaction_seconds"),
+		get_average(metrics, "teerank_update_transaction_statements"),
+		get_average(metrics, "teerank_update_transaction_rows"));
+	print_status("Transactions", comment, STATUS_OK);
+}
+
 int main_html_status(int argc, char **argv)
 {
 	const char *title;
@@ -133,6 +269,8 @@ int main_html_status(int argc, char **argv)
 		print_status(title, NULL, STATUS_OK);
 	}
 
+	show_ranks_status(teerank_stopped);
+
 	title = "2.x backward compatibility";
 	if (ROUTE_V2_URLS)
 		print_status(title, NULL, STATUS_ENABLED);
@@ -145,6 +283,7 @@ int main_html_status(int argc, char **argv)
 	else
 		print_status(title, NULL, STATUS_DISABLED);
 
+	show_update_status(teerank_stopped);
 	show_masters_status(teerank_stopped);
 	html_footer(NULL, NULL);
 
@@ -108,12 +108,15 @@ static char *convert_hexname(char *hexname)
 static void set_pagelist_args(
 	struct route *this, struct url *url, char *order)
 {
-	char *p = "1";
+	char *p = "1", *after = NULL;
 	unsigned i;
 
-	for (i = 0; i < url->nargs; i++)
+	for (i = 0; i < url->nargs; i++) {
 		if (strcmp(url->args[i].name, "p") == 0 && url->args[i].val)
 			p = url->args[i].val;
+		if (strcmp(url->args[i].name, "after") == 0 && url->args[i].val)
+			after = url->args[i].val;
+	}
 
 	this->args[1] = p;
 
@@ -121,6 +124,9 @@ static void set_pagelist_args(
 		this->args[2] = url->dirs[1];
 	else
 		this->args[2] = order;
+
+	/* Optional, pages are then selected by key instead of offset */
+	this->args[3] = after;
 }
 
 static void setup_html_player_list(struct route *this, struct url *url)
@@ -182,7 +188,15 @@ static void setup_json_server(struct route *this, struct url *url)
 
 static void setup_svg_graph(struct route *this, struct url *url)
 {
+	unsigned i;
+
 	this->args[1] = url->dirs[url->ndirs - 2];
+
+	/* Optional, the latest records are used otherwise */
+	this->args[2] = NULL;
+	for (i = 0; i < url->nargs; i++)
+		if (strcmp(url->args[i].name, "range") == 0)
+			this->args[2] = url->args[i].val;
 }
 
 static void setup_html_search(struct route *this, struct url *url)
@@ -351,6 +365,7 @@ struct route *do_route(char *uri, char *query)
 {
 	struct route *route;
 	struct url url;
+	unsigned i;
 
 	url = parse_url(uri, query);
 	route = find_route(&url);
@@ -358,6 +373,10 @@ struct route *do_route(char *uri, char *query)
 	if (!route)
 		error(404, NULL);
 
+	/* Routes are reused across requests in SCGI mode */
+	for (i = 1; i < MAX_ARGS; i++)
+		route->args[i] = NULL;
+
 	route->setup(route, &url);
 
 	return route;
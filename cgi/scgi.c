@@ -0,0 +1,281 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/time.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netdb.h>
+
+#include "scgi.h"
+
+#define MAX_HEADERS_SIZE 16384
+#define MAX_HEADERS 128
+
+static char buf[MAX_HEADERS_SIZE];
+
+static unsigned nheaders;
+static struct header {
+	char *name, *value;
+} headers[MAX_HEADERS];
+
+static int listen_unix(const char *path)
+{
+	struct sockaddr_un addr = { 0 };
+	struct stat st;
+	int sock;
+
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "%s: Socket path too long\n", path);
+		return -1;
+	}
+
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+
+	if ((sock = socket(AF_UNIX, SOCK_STREAM, 0)) == -1) {
+		perror("socket(unix)");
+		return -1;
+	}
+
+	/*
+	 * Remove the socket left by a previous instance, if any.  Anything
+	 * else is left alone, and bind() will fail.
+	 */
+	if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode))
+		unlink(path);
+
+	if (bind(sock, (struct sockaddr*)&addr, sizeof(addr)) == -1) {
+		perror(path);
+		close(sock);
+		return -1;
+	}
+
+	return sock;
+}
+
+static int listen_inet(const char *addr)
+{
+	char node[1024], *service;
+	struct addrinfo hints = { 0 }, *res;
+	int sock, ret, yes = 1;
+
+	snprintf(node, sizeof(node), "%s", addr);
+	if (!(service = strrchr(node, ':'))) {
+		fprintf(stderr, "%s: Expected \"host:port\"\n", addr);
+		return -1;
+	}
+	*service++ = '\0';
+
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_PASSIVE;
+
+	ret = getaddrinfo(*node ? node : NULL, service, &hints, &res);
+	if (ret != 0) {
+		fprintf(stderr, "getaddrinfo(%s, %s): %s\n",
+		        node, service, gai_strerror(ret));
+		return -1;
+	}
+
+	if ((sock = socket(res->ai_family, SOCK_STREAM, 0)) == -1) {
+		perror("socket()");
+		freeaddrinfo(res);
+		return -1;
+	}
+
+	setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+
+	if (bind(sock, res->ai_addr, res->ai_addrlen) == -1) {
+		perror(addr);
+		freeaddrinfo(res);
+		close(sock);
+		return -1;
+	}
+
+	freeaddrinfo(res);
+	return sock;
+}
+
+int scgi_listen(const char *addr)
+{
+	int sock;
+
+	if (strchr(addr, '/'))
+		sock = listen_unix(addr);
+	else
+		sock = listen_inet(addr);
+
+	if (sock == -1)
+		return -1;
+
+	if (listen(sock, SOMAXCONN) == -1) {
+		perror("listen()");
+		close(sock);
+		return -1;
+	}
+
+	return sock;
+}
+
+static pid_t fork_worker(void)
+{
+	pid_t pid;
+
+	if ((pid = fork()) == -1)
+		perror("fork()");
+
+	/*
+	 * The webserver may close the connection before we are done
+	 * writing the response, it should not kill the worker.
+	 */
+	if (pid == 0)
+		signal(SIGPIPE, SIG_IGN);
+
+	return pid;
+}
+
+void scgi_prefork(unsigned nworkers)
+{
+	unsigned i;
+	pid_t pid;
+
+	if (!nworkers)
+		nworkers = 1;
+
+	for (i = 0; i < nworkers; i++)
+		if (fork_worker() == 0)
+			return;
+
+	/*
+	 * A worker shouldn't die, but if it does we don't want to end
+	 * up with no workers at all.  Wait a bit before restarting it so
+	 * that a worker failing at startup doesn't make us spin.
+	 */
+	for (;;) {
+		pid = wait(NULL);
+		if (pid == -1) {
+			if (errno == EINTR)
+				continue;
+			perror("wait()");
+			exit(EXIT_FAILURE);
+		}
+
+		sleep(1);
+		if (fork_worker() == 0)
+			return;
+	}
+}
+
+/* Read at least "size" bytes, return the number of bytes read */
+static size_t read_atleast(int fd, char *dst, size_t size, size_t max)
+{
+	size_t len = 0;
+	ssize_t ret;
+
+	while (len < size) {
+		ret = read(fd, dst + len, max - len);
+		if (ret == -1 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			break;
+		len += ret;
+	}
+
+	return len;
+}
+
+/*
+ * Headers are sent as a netstring: "<length>:<headers>,", where headers
+ * are NUL separated names and values.  The request body, if any, is
+ * not used.
+ */
+static int read_headers(int fd)
+{
+	size_t len = 0, ret, size;
+	char *colon, *end, *s;
+
+	nheaders = 0;
+
+	while (!(colon = memchr(buf, ':', len)) && len < 16) {
+		if (!(ret = read_atleast(fd, buf + len, 1, sizeof(buf) - 1 - len)))
+			return 0;
+		len += ret;
+	}
+
+	if (!colon)
+		return 0;
+
+	*colon = '\0';
+	size = strtoul(buf, &end, 10);
+	if (*end || end == buf)
+		return 0;
+
+	/* Headers and the trailing comma must fit in the buffer */
+	if (size + 1 > sizeof(buf) - 1 - (colon + 1 - buf))
+		return 0;
+
+	s = colon + 1;
+	end = s + size;
+
+	/* Read headers and the trailing comma */
+	if (end + 1 > buf + len)
+		len += read_atleast(fd, buf + len, end + 1 - (buf + len), sizeof(buf) - 1 - len);
+	if (end + 1 > buf + len || *end != ',')
+		return 0;
+	*end = '\0';
+
+	while (s < end && nheaders < MAX_HEADERS) {
+		headers[nheaders].name = s;
+		s += strlen(s) + 1;
+		if (s >= end)
+			return 0;
+
+		headers[nheaders].value = s;
+		s += strlen(s) + 1;
+		nheaders++;
+	}
+
+	return 1;
+}
+
+int scgi_accept(int sock)
+{
+	struct timeval timeout = { 5, 0 };
+	int fd;
+
+	for (;;) {
+		if ((fd = accept(sock, NULL, NULL)) == -1) {
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			perror("accept()");
+			return -1;
+		}
+
+		/* Don't let a stalled connection block the worker forever */
+		setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+		setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+		if (read_headers(fd))
+			return fd;
+
+		fprintf(stderr, "scgi: Malformed request\n");
+		close(fd);
+	}
+}
+
+char *scgi_getenv(const char *name)
+{
+	unsigned i;
+
+	for (i = 0; i < nheaders; i++)
+		if (strcmp(headers[i].name, name) == 0)
+			return headers[i].value;
+
+	return NULL;
+}
@@ -0,0 +1,33 @@
+#ifndef SCGI_H
+#define SCGI_H
+
+/*
+ * SCGI is a much simpler protocol than FastCGI: the webserver open a
+ * connection, send every CGI variables in a netstring, then read the
+ * response until the connection is closed.  The response is exactly
+ * what a CGI would print.  That's all we need to keep the process (and
+ * the database connection) alive between requests.
+ */
+
+/*
+ * Listen on the given address, either "host:port" or a UNIX socket
+ * path.  Return the listening socket, or -1 on failure.
+ */
+int scgi_listen(const char *addr);
+
+/*
+ * Fork the given number of workers, and restart them when they die.
+ * Only returns in workers, the parent process never returns.
+ */
+void scgi_prefork(unsigned nworkers);
+
+/*
+ * Wait for a connection and read its request headers.  Return the
+ * connection socket, ready to be written, or -1 on failure.
+ */
+int scgi_accept(int sock);
+
+/* Value of the given variable for the current request, or NULL */
+char *scgi_getenv(const char *name);
+
+#endif /* SCGI_H */
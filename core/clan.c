@@ -3,6 +3,7 @@
 
 #include "clan.h"
 #include "teerank.h"
+#include "database.h"
 
 void read_clan(sqlite3_stmt *res, void *_c)
 {
@@ -10,20 +11,13 @@ void read_clan(sqlite3_stmt *res, void *_c)
 
 	snprintf(c->name, sizeof(c->name), "%s", sqlite3_column_text(res, 0));
 	c->nmembers = sqlite3_column_int64(res, 1);
+	c->total_elo = sqlite3_column_int(res, 2);
+
+	/* NULL when no members are ranked, read as zero, hence UNRANKED */
+	c->best_rank = sqlite3_column_int64(res, 3);
 }
 
 unsigned count_clans(void)
 {
-	/*
-	 * Turns out 'SELECT DISTINCT ...' is slower than 'SELECT
-	 * COUNT(1) FROM (SELECT DISTINCT ...)'.
-	 */
-	const char *query =
-		"SELECT COUNT(1)"
-		" FROM"
-		" (SELECT DISTINCT clan"
-		"  FROM players"
-		"  WHERE" IS_VALID_CLAN ")";
-
-	return count_rows(query);
+	return count_rows("SELECT nclans FROM stats");
 }
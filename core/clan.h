@@ -6,9 +6,18 @@
 struct clan {
 	char name[NAME_LENGTH];
 	unsigned nmembers;
+	int total_elo;
+	unsigned best_rank;
 };
 
-#define ALL_CLAN_COLUMNS " clan, COUNT(1) AS nmembers "
+/*
+ * Clans are read from the "clans" table, a derived table maintained
+ * from players.  "total_elo" is the sum of members elo, and
+ * "best_rank" is UNRANKED when no members are ranked.
+ */
+#define ALL_CLAN_COLUMNS " name, nmembers, total_elo, best_rank "
+
+#define SORT_BY_NMEMBERS " nmembers DESC, name "
 
 #define IS_VALID_CLAN \
 	" clan <> '' "
@@ -18,6 +27,7 @@ void read_clan(sqlite3_stmt *res, void *c);
 #define foreach_clan(query, m, ...) \
 	foreach_row(query, read_clan, m, __VA_ARGS__)
 
+/* Number of clans, read from the "stats" table, see stats.h */
 unsigned count_clans(void);
 
 #endif /* CLAN_H */
@@ -2,12 +2,15 @@
 #include <stdio.h>
 #include <assert.h>
 #include <time.h>
+#include <string.h>
 #include <sys/stat.h>
 
 #include "database.h"
 #include "teerank.h"
 #include "master.h"
 #include "player.h"
+#include "clan.h"
+#include "server.h"
 
 sqlite3 *db = NULL;
 
@@ -113,7 +116,7 @@ static int init_masters_table(void)
 	int ret = 1;
 
 	const char *query =
-		"INSERT INTO masters"
+		"INSERT INTO masters(" ALL_MASTER_COLUMNS ")"
 		" VALUES(?, ?, ?, ?)";
 
 	for (master = DEFAULT_MASTERS; *master->node; master++)
@@ -153,6 +156,478 @@ void drop_all_indices(void)
 	exec("DROP INDEX players_by_clan");
 }
 
+/*
+ * Add records from the given source to every rollups.  Records must be
+ * processed in chronological order so that the latest one of a period
+ * is the one kept.  Monthly periods start at the beginning of the month
+ * instead of being a multiple of the resolution.
+ */
+#define ROLLUP_RESOLUTIONS \
+	"(SELECT 3600 AS resolution" \
+	" UNION ALL SELECT 86400" \
+	" UNION ALL SELECT 2592000)"
+
+#define ROLLUP_PERIOD \
+	"CASE resolution" \
+	" WHEN 2592000 THEN" \
+	"  CAST(strftime('%s', timestamp, 'unixepoch', 'start of month') AS INTEGER)" \
+	" ELSE timestamp - timestamp % resolution END"
+
+#define UPSERT_ROLLUP(source) \
+	"INSERT INTO player_historic_rollup" \
+	" SELECT name, resolution, " ROLLUP_PERIOD "," \
+	"  timestamp, elo, rank, elo, elo, rank, rank" \
+	" FROM " source ", " ROLLUP_RESOLUTIONS \
+	" WHERE true" \
+	" ORDER BY timestamp" \
+	" ON CONFLICT DO UPDATE SET" \
+	"  timestamp = MAX(timestamp, excluded.timestamp)," \
+	"  elo = IIF(excluded.timestamp >= timestamp, excluded.elo, elo)," \
+	"  rank = IIF(excluded.timestamp >= timestamp, excluded.rank, rank)," \
+	"  min_elo = MIN(min_elo, excluded.elo)," \
+	"  max_elo = MAX(max_elo, excluded.elo)," \
+	"  min_rank = MIN(min_rank, excluded.rank)," \
+	"  max_rank = MAX(max_rank, excluded.rank)"
+
+/* Best rank among ranked members of the given clan, NULL if none */
+#define CLAN_BEST_RANK(clan) \
+	"(SELECT MIN(rank) FROM players" \
+	" WHERE clan = " clan " AND" IS_PLAYER_RANKED ")"
+
+/*
+ * Add or remove a player from its clan, creating the clan for its first
+ * member and removing it with its last one.  Players without clan are
+ * never added, hence removing them doesn't change anything.
+ */
+#define ADD_CLAN_MEMBER \
+	"INSERT INTO clans" \
+	" SELECT new.clan, 1, new.elo, NULLIF(new.rank, 0)" \
+	" WHERE new.clan <> ''" \
+	" ON CONFLICT(name) DO UPDATE SET" \
+	"  nmembers = nmembers + 1," \
+	"  total_elo = total_elo + excluded.total_elo," \
+	"  best_rank = COALESCE(MIN(best_rank, excluded.best_rank)," \
+	"                       best_rank, excluded.best_rank)"
+
+#define REMOVE_CLAN_MEMBER \
+	"UPDATE clans SET" \
+	" nmembers = nmembers - 1," \
+	" total_elo = total_elo - old.elo," \
+	" best_rank = IIF(best_rank = old.rank," \
+	"                 " CLAN_BEST_RANK("old.clan") ", best_rank)" \
+	" WHERE name = old.clan;" \
+	"DELETE FROM clans" \
+	" WHERE name = old.clan AND nmembers = 0"
+
+/* One if the server row is a vanilla CTF server, zero otherwise */
+#define IS_VANILLA_ROW(row) \
+	" EXISTS (SELECT 1 FROM" \
+	"  (SELECT " row ".gametype AS gametype, " row ".map AS map," \
+	"   " row ".max_clients AS max_clients)" \
+	"  WHERE" IS_VANILLA_CTF_SERVER ")"
+
+/*
+ * Derived tables only hold data computed from other tables, and are
+ * kept up to date by triggers.  Since they can always be rebuilt, they
+ * are not part of the versioned database layout: they are created and
+ * filled from existing data whenever they are missing.
+ *
+ * Triggers are attached to the source table, so they must be dropped
+ * before being created again.
+ */
+static const struct derived_table {
+	const char *name;
+	const char *queries[16];
+} DERIVED_TABLES[] = { {
+	/*
+	 * Trigram index of players names and clans, for substring
+	 * search.  Rows share their rowid with the "players" table.
+	 */
+	"players_search", {
+		"DROP TRIGGER IF EXISTS players_search_insert",
+		"DROP TRIGGER IF EXISTS players_search_update",
+		"DROP TRIGGER IF EXISTS players_search_delete",
+
+		"CREATE VIRTUAL TABLE players_search"
+		" USING fts5(name, clan, tokenize = 'trigram')",
+
+		"INSERT INTO players_search(rowid, name, clan)"
+		" SELECT rowid, name, clan FROM players",
+
+		"CREATE TRIGGER players_search_insert"
+		" AFTER INSERT ON players BEGIN"
+		"  INSERT INTO players_search(rowid, name, clan)"
+		"  VALUES (new.rowid, new.name, new.clan);"
+		" END",
+
+		"CREATE TRIGGER players_search_update"
+		" AFTER UPDATE OF name, clan ON players"
+		" WHEN old.name IS NOT new.name OR old.clan IS NOT new.clan BEGIN"
+		"  UPDATE players_search SET name = new.name, clan = new.clan"
+		"  WHERE rowid = old.rowid;"
+		" END",
+
+		"CREATE TRIGGER players_search_delete"
+		" AFTER DELETE ON players BEGIN"
+		"  DELETE FROM players_search WHERE rowid = old.rowid;"
+		" END",
+
+		NULL
+	}
+}, {
+	/* Same thing for servers names */
+	"servers_search", {
+		"DROP TRIGGER IF EXISTS servers_search_insert",
+		"DROP TRIGGER IF EXISTS servers_search_update",
+		"DROP TRIGGER IF EXISTS servers_search_delete",
+
+		"CREATE VIRTUAL TABLE servers_search"
+		" USING fts5(name, tokenize = 'trigram')",
+
+		"INSERT INTO servers_search(rowid, name)"
+		" SELECT rowid, name FROM servers",
+
+		"CREATE TRIGGER servers_search_insert"
+		" AFTER INSERT ON servers BEGIN"
+		"  INSERT INTO servers_search(rowid, name)"
+		"  VALUES (new.rowid, new.name);"
+		" END",
+
+		"CREATE TRIGGER servers_search_update"
+		" AFTER UPDATE OF name ON servers"
+		" WHEN old.name IS NOT new.name BEGIN"
+		"  UPDATE servers_search SET name = new.name"
+		"  WHERE rowid = old.rowid;"
+		" END",
+
+		"CREATE TRIGGER servers_search_delete"
+		" AFTER DELETE ON servers BEGIN"
+		"  DELETE FROM servers_search WHERE rowid = old.rowid;"
+		" END",
+
+		NULL
+	}
+}, {
+	/*
+	 * Hourly, daily and monthly rollups of player_historic, so that
+	 * graphs spanning a long time range read a bounded number of
+	 * rows.  Resolutions are the ones defined in player.h.  Each
+	 * rollup has the last elo and rank of the period, as well as
+	 * their minimum and maximum.
+	 */
+	"player_historic_rollup", {
+		"DROP TRIGGER IF EXISTS player_historic_rollup_insert",
+
+		"CREATE TABLE player_historic_rollup("
+		" name TEXT,"
+		" resolution INTEGER,"
+		" period DATE,"
+		" timestamp DATE,"
+		" elo INTEGER,"
+		" rank INTEGER,"
+		" min_elo INTEGER,"
+		" max_elo INTEGER,"
+		" min_rank INTEGER,"
+		" max_rank INTEGER,"
+		" PRIMARY KEY(name, resolution, period))"
+		" WITHOUT ROWID",
+
+		UPSERT_ROLLUP("player_historic"),
+
+		"CREATE TRIGGER player_historic_rollup_insert"
+		" AFTER INSERT ON player_historic BEGIN "
+		UPSERT_ROLLUP(
+			"(SELECT new.name AS name, new.timestamp AS timestamp,"
+			" new.elo AS elo, new.rank AS rank)") ";"
+		" END",
+
+		NULL
+	}
+}, {
+	/*
+	 * Clans, with their number of members, the sum of their members
+	 * elo and their best rank, kept up to date by triggers.  Members
+	 * are indexed by rank so that the best rank of a clan can be
+	 * found again when its best member loses it.
+	 */
+	"clans", {
+		"DROP TRIGGER IF EXISTS clans_insert",
+		"DROP TRIGGER IF EXISTS clans_update",
+		"DROP TRIGGER IF EXISTS clans_update_elo",
+		"DROP TRIGGER IF EXISTS clans_update_rank",
+		"DROP TRIGGER IF EXISTS clans_delete",
+		"DROP INDEX IF EXISTS players_by_clan_and_rank",
+
+		"CREATE TABLE clans("
+		" name TEXT,"
+		" nmembers INTEGER,"
+		" total_elo INTEGER,"
+		" best_rank INTEGER,"
+		" PRIMARY KEY(name))",
+
+		"CREATE INDEX clans_by_nmembers ON clans (" SORT_BY_NMEMBERS ")",
+		"CREATE INDEX players_by_clan_and_rank ON players (clan, rank)",
+
+		"INSERT INTO clans"
+		" SELECT clan, COUNT(1), SUM(elo), MIN(NULLIF(rank, 0))"
+		" FROM players"
+		" WHERE" IS_VALID_CLAN
+		" GROUP BY clan",
+
+		"CREATE TRIGGER clans_insert"
+		" AFTER INSERT ON players BEGIN "
+		ADD_CLAN_MEMBER ";"
+		" END",
+
+		"CREATE TRIGGER clans_update"
+		" AFTER UPDATE OF clan ON players"
+		" WHEN old.clan IS NOT new.clan BEGIN "
+		REMOVE_CLAN_MEMBER ";"
+		ADD_CLAN_MEMBER ";"
+		" END",
+
+		"CREATE TRIGGER clans_update_elo"
+		" AFTER UPDATE OF elo ON players"
+		" WHEN new.clan <> '' AND old.clan IS new.clan"
+		"  AND old.elo IS NOT new.elo BEGIN"
+		"  UPDATE clans SET total_elo = total_elo - old.elo + new.elo"
+		"  WHERE name = new.clan;"
+		" END",
+
+		/*
+		 * Only look for the best rank again when the best member
+		 * rank did change, that is when it lost it.
+		 */
+		"CREATE TRIGGER clans_update_rank"
+		" AFTER UPDATE OF rank ON players"
+		" WHEN new.clan <> '' AND old.clan IS new.clan"
+		"  AND old.rank IS NOT new.rank BEGIN"
+		"  UPDATE clans SET best_rank = IIF(best_rank = old.rank,"
+		"   " CLAN_BEST_RANK("new.clan") ", new.rank)"
+		"  WHERE name = new.clan AND (best_rank = old.rank"
+		"   OR (new.rank > 0 AND (best_rank IS NULL OR new.rank < best_rank)));"
+		" END",
+
+		"CREATE TRIGGER clans_delete"
+		" AFTER DELETE ON players BEGIN "
+		REMOVE_CLAN_MEMBER ";"
+		" END",
+
+		NULL
+	}
+}, {
+	/*
+	 * Servers are listed by their number of clients, stored in the
+	 * "servers" table and written by teerank-update.
+	 */
+	"servers_by_num_clients", {
+		"CREATE INDEX servers_by_num_clients"
+		" ON servers (" SORT_BY_NUM_CLIENTS ")"
+		" WHERE" IS_VANILLA_CTF_SERVER,
+
+		NULL
+	}
+}, {
+	/*
+	 * Single row of site-wide statistics, see stats.h.  It comes
+	 * after "clans" because it is filled from it.
+	 */
+	"stats", {
+		"DROP TRIGGER IF EXISTS stats_clans_insert",
+		"DROP TRIGGER IF EXISTS stats_clans_delete",
+		"DROP TRIGGER IF EXISTS stats_servers_insert",
+		"DROP TRIGGER IF EXISTS stats_servers_update",
+		"DROP TRIGGER IF EXISTS stats_servers_delete",
+
+		"CREATE TABLE stats("
+		" nplayers INTEGER,"
+		" nclans INTEGER,"
+		" nservers INTEGER,"
+		" last_ranks_update DATE,"
+		" ranks_update_duration INTEGER)",
+
+		"INSERT INTO stats VALUES ("
+		" (SELECT COUNT(1) FROM players WHERE" IS_PLAYER_RANKED "),"
+		" (SELECT COUNT(1) FROM clans),"
+		" (SELECT COUNT(1) FROM servers WHERE" IS_VANILLA_CTF_SERVER "),"
+		" 0, 0)",
+
+		"CREATE TRIGGER stats_clans_insert"
+		" AFTER INSERT ON clans BEGIN"
+		"  UPDATE stats SET nclans = nclans + 1;"
+		" END",
+
+		"CREATE TRIGGER stats_clans_delete"
+		" AFTER DELETE ON clans BEGIN"
+		"  UPDATE stats SET nclans = nclans - 1;"
+		" END",
+
+		"CREATE TRIGGER stats_servers_insert"
+		" AFTER INSERT ON servers"
+		" WHEN" IS_VANILLA_ROW("new") "BEGIN"
+		"  UPDATE stats SET nservers = nservers + 1;"
+		" END",
+
+		"CREATE TRIGGER stats_servers_update"
+		" AFTER UPDATE OF gametype, map, max_clients ON servers BEGIN"
+		"  UPDATE stats SET nservers = nservers"
+		"   +" IS_VANILLA_ROW("new") "-" IS_VANILLA_ROW("old") ";"
+		" END",
+
+		"CREATE TRIGGER stats_servers_delete"
+		" AFTER DELETE ON servers"
+		" WHEN" IS_VANILLA_ROW("old") "BEGIN"
+		"  UPDATE stats SET nservers = nservers - 1;"
+		" END",
+
+		NULL
+	}
+}, { NULL } };
+
+static int create_derived_table(const struct derived_table *table)
+{
+	const char * const *query;
+
+	if (!exec("BEGIN"))
+		return 0;
+
+	for (query = table->queries; *query; query++)
+		if (!exec(*query))
+			goto fail;
+
+	if (!exec("COMMIT"))
+		goto fail;
+
+	return 1;
+
+fail:
+	exec("ROLLBACK");
+	return 0;
+}
+
+static int derived_table_exists(const struct derived_table *table)
+{
+	const char *query =
+		"SELECT COUNT(1)"
+		" FROM sqlite_master"
+		" WHERE name = ?";
+
+	return count_rows(query, "s", table->name);
+}
+
+int have_derived_tables(void)
+{
+	const struct derived_table *table;
+
+	for (table = DERIVED_TABLES; table->name; table++)
+		if (!derived_table_exists(table))
+			return 0;
+
+	return 1;
+}
+
+int create_derived_tables(void)
+{
+	const struct derived_table *table;
+	int ret = 1;
+
+	for (table = DERIVED_TABLES; table->name; table++) {
+		if (derived_table_exists(table))
+			continue;
+
+		verbose("Creating derived table %s", table->name);
+
+		if (!create_derived_table(table)) {
+			fprintf(stderr, "%s: Couldn't create derived table %s\n",
+			        config.dbpath, table->name);
+			ret = 0;
+		}
+	}
+
+	return ret;
+}
+
+static int column_exists(const char *table, const char *column)
+{
+	const char *query =
+		"SELECT COUNT(1)"
+		" FROM pragma_table_info(?)"
+		" WHERE name = ?";
+
+	return count_rows(query, "ss", table, column);
+}
+
+/*
+ * Version 8 stores the number of clients of each server, and the
+ * number of servers listed by each master.  Databases built by a
+ * development version may already have them, as they used to be
+ * added along with the "servers_by_num_clients" index.
+ */
+static int upgrade_from_7(void)
+{
+	if (!column_exists("servers", "num_clients") &&
+	    !exec("ALTER TABLE servers"
+	          " ADD COLUMN num_clients INTEGER NOT NULL DEFAULT 0"))
+		return 0;
+
+	if (!column_exists("masters", "nservers") &&
+	    !exec("ALTER TABLE masters"
+	          " ADD COLUMN nservers INTEGER NOT NULL DEFAULT 0"))
+		return 0;
+
+	if (!exec("UPDATE servers SET num_clients ="
+	          " (SELECT COUNT(1) FROM server_clients AS sc"
+	          "  WHERE sc.ip = servers.ip AND sc.port = servers.port)"))
+		return 0;
+
+	if (!exec("UPDATE masters SET nservers ="
+	          " (SELECT COUNT(1) FROM servers"
+	          "  WHERE master_node = node AND master_service = service)"))
+		return 0;
+
+	/*
+	 * Clans used to be stored without their elo and best rank.  They
+	 * are derived tables, teerank-update will create them again, as
+	 * well as "stats" which has triggers on clans.
+	 */
+	if (!column_exists("clans", "best_rank") &&
+	    (!exec("DROP TABLE IF EXISTS clans") ||
+	     !exec("DROP TABLE IF EXISTS stats")))
+		return 0;
+
+	return 1;
+}
+
+int upgrade_database(void)
+{
+	int version;
+
+	if (!exec("BEGIN EXCLUSIVE"))
+		return 0;
+
+	version = database_version();
+
+	if (version < 7) {
+		fprintf(stderr, "%s: Can't upgrade from version %d\n",
+		        config.dbpath, version);
+		goto fail;
+	}
+
+	if (version < 8 && !upgrade_from_7())
+		goto fail;
+
+	if (!exec("UPDATE version SET version = ?", "i", DATABASE_VERSION))
+		goto fail;
+	if (!exec("COMMIT"))
+		goto fail;
+
+	return 1;
+
+fail:
+	exec("ROLLBACK");
+	return 0;
+}
+
 static int create_database(void)
 {
 	const int FLAGS = SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE;
@@ -167,6 +642,7 @@ static int create_database(void)
 		" service TEXT,"
 		" lastseen DATE,"
 		" expire DATE,"
+		" nservers INTEGER NOT NULL DEFAULT 0,"
 		" PRIMARY KEY(node, service))",
 
 		"CREATE TABLE servers("
@@ -180,6 +656,7 @@ static int create_database(void)
 		" master_node TEXT,"
 		" master_service TEXT,"
 		" max_clients INTEGER,"
+		" num_clients INTEGER NOT NULL DEFAULT 0,"
 		" PRIMARY KEY(ip, port),"
 		" FOREIGN KEY(master_node, master_service)"
 		"  REFERENCES masters(node, service))",
@@ -284,8 +761,7 @@ fail:
 
 static void close_database(void)
 {
-	/* Using NULL as a query free internal buffers exec() may keep */
-	exec(NULL);
+	free_statements();
 
 	if (sqlite3_close(db) != SQLITE_OK)
 		errmsg("close_database", NULL);
@@ -318,13 +794,180 @@ int init_database(int readonly)
 	return 1;
 }
 
+/*
+ * Prepared statements are cached by query text, so that any query is
+ * prepared once for the lifetime of the process, even when queries are
+ * interleaved or built at runtime.  Cached statements are reset instead
+ * of finalized when done.
+ *
+ * The cache is an open addressing hash table.  When there is no room
+ * left, or when the cached statement is already in use (nested loops
+ * on the same query), we fallback to an uncached statement.
+ */
+#define STMT_CACHE_SIZE 256
+#define STMT_CACHE_PROBES 8
+
+static struct cached_stmt {
+	unsigned hash;
+	sqlite3_stmt *res;
+} stmt_cache[STMT_CACHE_SIZE];
+
+static unsigned stmt_cache_hits, stmt_cache_misses;
+
+/*
+ * Uncached statements in use, so that release() knows which ones to
+ * finalize without looking for them in the cache.  Only nested loops
+ * on the same query, or queries colliding in the cache, use them,
+ * hence there are very few at once.
+ */
+#define MAX_UNCACHED_STMTS 32
+
+static sqlite3_stmt *uncached_stmts[MAX_UNCACHED_STMTS];
+static unsigned nuncached_stmts;
+
+struct query_stats query_stats;
+
+static double now_ms(void)
+{
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) == -1)
+		return 0;
+
+	return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+/* Same as sqlite3_step(), but account rows and time spent */
+static int step(sqlite3_stmt *res)
+{
+	double start = now_ms();
+	int ret;
+
+	ret = sqlite3_step(res);
+
+	query_stats.ms += now_ms() - start;
+	if (ret == SQLITE_ROW)
+		query_stats.rows++;
+
+	return ret;
+}
+
+static unsigned hash_query(const char *query)
+{
+	unsigned h = 2166136261u;
+
+	/* FNV-1a */
+	for (; *query; query++)
+		h = (h ^ (unsigned char)*query) * 16777619u;
+
+	return h;
+}
+
+static sqlite3_stmt *prepare(const char *query)
+{
+	struct cached_stmt *slot = NULL, *it;
+	sqlite3_stmt *res;
+	unsigned h, i;
+	double start;
+	int ret;
+
+	assert(query);
+
+	query_stats.queries++;
+
+	h = hash_query(query);
+
+	for (i = 0; i < STMT_CACHE_PROBES; i++) {
+		it = &stmt_cache[(h + i) % STMT_CACHE_SIZE];
+
+		if (!it->res) {
+			slot = it;
+			break;
+		}
+
+		if (it->hash != h || strcmp(sqlite3_sql(it->res), query) != 0)
+			continue;
+
+		if (sqlite3_stmt_busy(it->res))
+			break;
+
+		/*
+		 * Failing to reset state and bindings is not fatal: we
+		 * can still fallback and use an uncached statement.
+		 */
+		if (sqlite3_reset(it->res) != SQLITE_OK)
+			break;
+		if (sqlite3_clear_bindings(it->res) != SQLITE_OK)
+			break;
+
+		stmt_cache_hits++;
+		return it->res;
+	}
+
+	stmt_cache_misses++;
+
+	start = now_ms();
+	ret = sqlite3_prepare_v2(db, query, -1, &res, NULL);
+	query_stats.ms += now_ms() - start;
+
+	if (ret != SQLITE_OK) {
+		sqlite3_finalize(res);
+		return NULL;
+	}
+
+	if (slot) {
+		slot->hash = h;
+		slot->res = res;
+	} else if (nuncached_stmts < MAX_UNCACHED_STMTS) {
+		uncached_stmts[nuncached_stmts++] = res;
+	} else {
+		fprintf(stderr, "prepare(): Too many uncached statements\n");
+		sqlite3_finalize(res);
+		return NULL;
+	}
+
+	return res;
+}
+
+static void release(sqlite3_stmt *res)
+{
+	unsigned i;
+
+	if (!res)
+		return;
+
+	for (i = 0; i < nuncached_stmts; i++) {
+		if (uncached_stmts[i] == res) {
+			uncached_stmts[i] = uncached_stmts[--nuncached_stmts];
+			sqlite3_finalize(res);
+			return;
+		}
+	}
+
+	sqlite3_reset(res);
+}
+
+void free_statements(void)
+{
+	unsigned i;
+
+	verbose(
+		"Statement cache: %u hits, %u misses",
+		stmt_cache_hits, stmt_cache_misses);
+
+	for (i = 0; i < STMT_CACHE_SIZE; i++) {
+		sqlite3_finalize(stmt_cache[i].res);
+		stmt_cache[i].res = NULL;
+	}
+}
+
 unsigned _count_rows(const char *query, const char *bindfmt, ...)
 {
 	va_list ap;
 	unsigned ret, count;
 	struct sqlite3_stmt *res;
 
-	if (sqlite3_prepare_v2(db, query, -1, &res, NULL) != SQLITE_OK)
+	if (!(res = prepare(query)))
 		goto fail;
 
 	va_start(ap, bindfmt);
@@ -333,81 +976,27 @@ unsigned _count_rows(const char *query, const char *bindfmt, ...)
 
 	if (!ret)
 		goto fail;
-	if (sqlite3_step(res) != SQLITE_ROW)
+	if (step(res) != SQLITE_ROW)
 		goto fail;
 
 	count = sqlite3_column_int64(res, 0);
 
-	sqlite3_finalize(res);
+	release(res);
 	return count;
 
 fail:
 	errmsg("count_rows", query);
-	sqlite3_finalize(res);
+	release(res);
 	return 0;
 }
 
-/*
- * If the given query is the same than the previous one, we want to
- * reset it and clear any bindings instead of re-preparing it: that's
- * faster.
- */
-static int prepare_query(const char *query, const char **prevquery, sqlite3_stmt **res)
-{
-	assert(query);
-	assert(!*prevquery || *res);
-
-	/*
-	 * Failing to reset state and bindings is not fatal: we can
-	 * still fallback and try to re-prepare the query.
-	 */
-	if (query == *prevquery) {
-		if (sqlite3_reset(*res) != SQLITE_OK)
-			goto prepare;
-		if (sqlite3_clear_bindings(*res) != SQLITE_OK)
-			goto prepare;
-
-		return 1;
-	}
-
-prepare:
-	if (*prevquery)
-		sqlite3_finalize(*res);
-
-	if (sqlite3_prepare_v2(db, query, -1, res, NULL) != SQLITE_OK) {
-		*prevquery = NULL;
-		return 0;
-	}
-
-	*prevquery = query;
-	return 1;
-}
-
-static void destroy_query(const char **prevquery, sqlite3_stmt **res)
-{
-	sqlite3_finalize(*res);
-	*prevquery = NULL;
-	*res = NULL;
-}
-
 int _exec(const char *query, const char *bindfmt, ...)
 {
-	static const char *prevquery;
-	static sqlite3_stmt *res;
-
+	sqlite3_stmt *res;
 	va_list ap;
 	int ret;
 
-	/*
-	 * NULL as a query allow to clean any prepared statement so that
-	 * sqlite3_close() will not return SQLITE3_BUSY.
-	 */
-	if (!query) {
-		destroy_query(&prevquery, &res);
-		return 1;
-	}
-
-	if (!prepare_query(query, &prevquery, &res))
+	if (!(res = prepare(query)))
 		goto fail;
 
 	va_start(ap, bindfmt);
@@ -417,14 +1006,16 @@ int _exec(const char *query, const char *bindfmt, ...)
 	if (!ret)
 		goto fail;
 
-	ret = sqlite3_step(res);
+	ret = step(res);
 	if (ret != SQLITE_ROW && ret != SQLITE_DONE)
 		goto fail;
 
+	release(res);
 	return 1;
 
 fail:
 	errmsg("exec", query);
+	release(res);
 	return 0;
 }
 
@@ -434,7 +1025,7 @@ sqlite3_stmt *foreach_init(const char *query, const char *bindfmt, ...)
 	va_list ap;
 	sqlite3_stmt *res;
 
-	if (sqlite3_prepare_v2(db, query, -1, &res, NULL))
+	if (!(res = prepare(query)))
 		goto fail;
 
 	va_start(ap, bindfmt);
@@ -447,7 +1038,7 @@ sqlite3_stmt *foreach_init(const char *query, const char *bindfmt, ...)
 	return res;
 fail:
 	errmsg("foreach_init", query);
-	sqlite3_finalize(res);
+	release(res);
 	return NULL;
 }
 
@@ -456,10 +1047,10 @@ int foreach_next(sqlite3_stmt **res, void *data, void (*read_row)(sqlite3_stmt*,
 	if (!*res)
 		return 0;
 
-	int ret = sqlite3_step(*res);
+	int ret = step(*res);
 
 	if (ret == SQLITE_DONE) {
-		sqlite3_finalize(*res);
+		release(*res);
 		return 0;
 	} else if (ret == SQLITE_ROW) {
 		if (read_row)
@@ -467,8 +1058,13 @@ int foreach_next(sqlite3_stmt **res, void *data, void (*read_row)(sqlite3_stmt*,
 		return 1;
 	} else {
 		errmsg("foreach_next", NULL);
-		sqlite3_finalize(*res);
+		release(*res);
 		*res = NULL;
 		return 0;
 	}
 }
+
+void foreach_end(sqlite3_stmt *res)
+{
+	release(res);
+}
@@ -13,6 +13,24 @@ int init_database(int readonly);
  */
 int database_version(void);
 
+/*
+ * Create and fill derived tables that are missing, such as search
+ * indices.  Requires write access to the database.
+ */
+int create_derived_tables(void);
+
+/*
+ * Return non-zero when no derived tables are missing.  Read-only
+ * processes can't create them and must wait for teerank-update to.
+ */
+int have_derived_tables(void);
+
+/*
+ * Upgrade a database created by a previous version of teerank, in
+ * place.  Requires write access to the database.
+ */
+int upgrade_database(void);
+
 /* Last time the database was updated */
 time_t last_database_update(void);
 
@@ -25,8 +43,7 @@ unsigned _count_rows(const char *query, const char *bindfmt, ...);
 
 /*
  * Helper to execute a query yielding no results, and binds data before
- * executing the query.  exec() keep the last query in memory, hence
- * reusing a query should not prepare() it each time.
+ * executing the query.
  */
 #define exec(query, ...) _exec(query, "" __VA_ARGS__)
 int _exec(const char *query, const char *bindfmt, ...);
@@ -35,6 +52,10 @@ int _exec(const char *query, const char *bindfmt, ...);
  * Helper to read result row from queries.  Prepare, run and clean up
  * resources necessary to process the given query.  User must have
  * declared "sqlite3_stmt *res; unsigned nrow;".
+ *
+ * Like exec() and count_rows(), prepared statements are cached by query
+ * text, hence the same query is prepared only once.  Statements must
+ * then be released with foreach_end(), not sqlite3_finalize().
  */
 #define foreach_row(query, read_row, buf, ...) for ( \
 	res = foreach_init(query, "" __VA_ARGS__), nrow = 0; \
@@ -42,9 +63,27 @@ int _exec(const char *query, const char *bindfmt, ...);
 )
 sqlite3_stmt *foreach_init(const char *query, const char *bindfmt, ...);
 int foreach_next(sqlite3_stmt **res, void *data, void (*read_row)(sqlite3_stmt*, void*));
+void foreach_end(sqlite3_stmt *res);
 
 /* Should be used instead of break; to exit foreach_row() loop */
-#define break_foreach { sqlite3_finalize(res); break; }
+#define break_foreach { foreach_end(res); break; }
+
+/*
+ * Queries run, rows stepped and milliseconds spent in SQLite by the
+ * helpers above, including statements preparation.  Zero it to start
+ * measuring.
+ */
+extern struct query_stats {
+	unsigned queries;
+	unsigned rows;
+	double ms;
+} query_stats;
+
+/*
+ * Finalize every cached statements, so that sqlite3_close() will not
+ * return SQLITE_BUSY.
+ */
+void free_statements(void);
 
 /*
  * The following functions are used when doing bulk insert/update.
@@ -38,8 +38,10 @@ void read_extended_master(sqlite3_stmt *res, void *m)
 int write_master(struct master *m)
 {
 	const char *query =
-		"INSERT OR REPLACE INTO masters"
-		" VALUES (?, ?, ?, ?)";
+		"INSERT OR REPLACE INTO masters(" ALL_EXTENDED_MASTER_COLUMNS ")"
+		" VALUES (?, ?, ?, ?, ?)";
 
-	return exec(query, "sstt", m->node, m->service, m->lastseen, m->expire);
+	return exec(
+		query, "ssttu", m->node, m->service, m->lastseen, m->expire,
+		m->nservers);
 }
@@ -9,15 +9,13 @@
 #define ALL_MASTER_COLUMNS \
 	" node, service, lastseen, expire "
 
-#define NSERVERS_COLUMN \
-	" (SELECT COUNT(1)" \
-	"  FROM servers" \
-	"  WHERE master_node = node" \
-	"  AND master_service = service)" \
-	" AS nservers "
-
+/*
+ * Number of servers listed by the master is stored in the "masters"
+ * table rather than counted.  It's updated each time the master is
+ * polled, see write_master().
+ */
 #define ALL_EXTENDED_MASTER_COLUMNS \
-	ALL_MASTER_COLUMNS "," NSERVERS_COLUMN
+	ALL_MASTER_COLUMNS ", nservers "
 
 #define NODE_STRSIZE 64
 #define SERVICE_STRSIZE 8
@@ -18,7 +18,7 @@ void init_player(struct player *player)
 	*player = PLAYER_ZERO;
 }
 
-void create_player(const char *name, const char *clan)
+struct player create_player(const char *name, const char *clan)
 {
 	struct player p;
 
@@ -36,6 +36,7 @@ void create_player(const char *name, const char *clan)
 	strcpy(p.server_port, "");
 
 	write_player(&p);
+	return p;
 }
 
 void read_player(sqlite3_stmt *res, void *_p)
@@ -62,9 +63,20 @@ void read_player_record(sqlite3_stmt *res, void *_r)
 
 int write_player(struct player *p)
 {
+	/*
+	 * Update the row in place rather than replacing it, so that it
+	 * keeps its rowid, which is used by derived tables.
+	 */
 	const char *query =
-		"INSERT OR REPLACE INTO players"
-		" VALUES (?, ?, ?, ?, ?, ?, ?)";
+		"INSERT INTO players"
+		" VALUES (?, ?, ?, ?, ?, ?, ?)"
+		" ON CONFLICT(name) DO UPDATE SET"
+		"  clan = excluded.clan,"
+		"  elo = excluded.elo,"
+		"  rank = excluded.rank,"
+		"  lastseen = excluded.lastseen,"
+		"  server_ip = excluded.server_ip,"
+		"  server_port = excluded.server_port";
 
 	if (exec(query, "ssiutss", p->name, p->clan, p->elo, p->rank, p->lastseen, p->server_ip, p->server_port))
 		return SUCCESS;
@@ -72,6 +84,66 @@ int write_player(struct player *p)
 		return FAILURE;
 }
 
+static int bind_player(sqlite3_stmt *res, int i, struct player *p)
+{
+	return sqlite3_bind_text(res, i, p->name, -1, SQLITE_STATIC) == SQLITE_OK
+		&& sqlite3_bind_text(res, i + 1, p->clan, -1, SQLITE_STATIC) == SQLITE_OK
+		&& sqlite3_bind_int(res, i + 2, p->elo) == SQLITE_OK
+		&& sqlite3_bind_int64(res, i + 3, p->rank) == SQLITE_OK
+		&& sqlite3_bind_int64(res, i + 4, p->lastseen) == SQLITE_OK
+		&& sqlite3_bind_text(res, i + 5, p->server_ip, -1, SQLITE_STATIC) == SQLITE_OK
+		&& sqlite3_bind_text(res, i + 6, p->server_port, -1, SQLITE_STATIC) == SQLITE_OK;
+}
+
+/* Rows per statement, SQLite limits the number of variables */
+#define MAX_UPSERT_ROWS 32
+
+unsigned write_players(struct player *players, unsigned n, void (*func)(struct player *p))
+{
+	char query[2048];
+	unsigned i, count, nrow, total = 0;
+	sqlite3_stmt *res;
+	struct player p;
+	int len;
+
+	const char *upsert =
+		" ON CONFLICT(name) DO UPDATE SET"
+		"  clan = excluded.clan,"
+		"  lastseen = excluded.lastseen,"
+		"  server_ip = excluded.server_ip,"
+		"  server_port = excluded.server_port"
+		" RETURNING" ALL_PLAYER_COLUMNS;
+
+	while (n) {
+		count = n < MAX_UPSERT_ROWS ? n : MAX_UPSERT_ROWS;
+
+		len = snprintf(query, sizeof(query), "INSERT INTO players VALUES");
+		for (i = 0; i < count; i++)
+			len += snprintf(query + len, sizeof(query) - len,
+			                "%s (?, ?, ?, ?, ?, ?, ?)", i ? "," : "");
+		snprintf(query + len, sizeof(query) - len, "%s", upsert);
+
+		res = foreach_init(query, "");
+		for (i = 0; res && i < count; i++) {
+			if (!bind_player(res, 7 * i + 1, &players[i])) {
+				fprintf(stderr, "write_players(): Cannot bind player %s\n", players[i].name);
+				foreach_end(res);
+				res = NULL;
+			}
+		}
+
+		for (nrow = 0; foreach_next(&res, &p, read_player); nrow++)
+			if (func)
+				func(&p);
+
+		total += nrow;
+		players += count;
+		n -= count;
+	}
+
+	return total;
+}
+
 void record_elo_and_rank(const char *pname)
 {
 	struct player p;
@@ -95,8 +167,5 @@ void record_elo_and_rank(const char *pname)
 
 unsigned count_ranked_players(void)
 {
-	const char *query =
-		"SELECT COUNT(1) FROM players WHERE" IS_PLAYER_RANKED;
-
-	return count_rows(query);
+	return count_rows("SELECT nplayers FROM stats");
 }
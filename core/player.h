@@ -49,6 +49,16 @@ struct player_record {
 
 void read_player_record(sqlite3_stmt *res, void *p);
 
+/*
+ * Resolutions, in seconds, of the "player_historic_rollup" table.  The
+ * table has the same record columns than "player_historic".  Monthly
+ * periods are calendar months, hence the resolution is only used as an
+ * identifier for them.
+ */
+#define HISTORIC_HOURLY 3600
+#define HISTORIC_DAILY 86400
+#define HISTORIC_MONTHLY 2592000
+
 /**
  * @struct player
  *
@@ -105,8 +115,10 @@ static const time_t EXPIRE_NOW = 0;
  * The player *is* written in the database.
  *
  * @param name Name of the new player
+ *
+ * @return The player as it was written in the database
  */
-void create_player(const char *name, const char *clan);
+struct player create_player(const char *name, const char *clan);
 
 /**
  * Write a player to the database.
@@ -117,6 +129,21 @@ void create_player(const char *name, const char *clan);
  */
 int write_player(struct player *player);
 
+/**
+ * Create or update many players with as few queries as possible.
+ *
+ * Players not in the database are written as they are.  Existing
+ * players only have their clan, lastseen date and server updated.
+ *
+ * @param players Players to write
+ * @param n Number of players
+ * @param func Called with each player as it is in the database after
+ *             the write, can be NULL
+ *
+ * @return Number of players written
+ */
+unsigned write_players(struct player *players, unsigned n, void (*func)(struct player *p));
+
 /**
  * Add an entry in player historic
  *
@@ -125,7 +152,8 @@ int write_player(struct player *player);
 void record_elo_and_rank(const char *pname);
 
 /**
- * Count the number of ranked players in the database
+ * Number of ranked players in the database, as of the last ranks
+ * update.  Read from the "stats" table, see stats.h.
  */
 unsigned count_ranked_players(void);
 
@@ -200,20 +200,36 @@ int write_server_clients(struct server *server)
 		"INSERT OR REPLACE INTO server_clients"
 		" VALUES (?, ?, ?, ?, ?, ?)";
 
+	const char *update =
+		"UPDATE servers SET num_clients = ?"
+		" WHERE ip = ? AND port = ?";
+
 	if (!flush_server_clients(server->ip, server->port))
 		return 0;
 
 	for (client = server->clients; client - server->clients < server->num_clients; client++)
 		ret &= exec(query, bind_client(*server, *client));
 
+	ret &= exec(update, "iss", server->num_clients, server->ip, server->port);
+
 	return ret;
 }
 
 int write_server(struct server *server)
 {
+	/* Keep the rowid, see write_player() */
 	const char *query =
-		"INSERT OR REPLACE INTO servers"
-		" VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?)";
+		"INSERT INTO servers(" ALL_SERVER_COLUMNS ")"
+		" VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?)"
+		" ON CONFLICT(ip, port) DO UPDATE SET"
+		"  name = excluded.name,"
+		"  gametype = excluded.gametype,"
+		"  map = excluded.map,"
+		"  lastseen = excluded.lastseen,"
+		"  expire = excluded.expire,"
+		"  master_node = excluded.master_node,"
+		"  master_service = excluded.master_service,"
+		"  max_clients = excluded.max_clients";
 
 	return exec(query, bind_server(*server));
 }
@@ -278,8 +294,5 @@ struct server create_server(
 
 unsigned count_vanilla_servers(void)
 {
-	const char *query =
-		"SELECT COUNT(1) FROM servers WHERE" IS_VANILLA_CTF_SERVER;
-
-	return count_rows(query);
+	return count_rows("SELECT nservers FROM stats");
 }
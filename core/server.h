@@ -27,15 +27,16 @@
 	" ip, port, name, gametype, map, lastseen, expire," \
 	" master_node, master_service, max_clients "
 
-#define NUM_CLIENTS_COLUMN \
-	" (SELECT COUNT(1)" \
-	"  FROM server_clients AS sc" \
-	"  WHERE sc.ip = servers.ip" \
-	"  AND sc.port = servers.port)" \
-	" AS num_clients "
-
+/*
+ * Number of clients is stored in the "servers" table rather than
+ * counted, see write_server_clients().  It's a derived column, created
+ * with the "servers_by_num_clients" index.
+ */
 #define ALL_EXTENDED_SERVER_COLUMNS \
-	ALL_SERVER_COLUMNS "," NUM_CLIENTS_COLUMN
+	ALL_SERVER_COLUMNS ", num_clients "
+
+#define SORT_BY_NUM_CLIENTS \
+	" num_clients DESC, ip, port "
 
 #define IS_VANILLA_CTF_SERVER \
 	" gametype = 'CTF'" \
@@ -189,7 +190,8 @@ void remove_server(const char *ip, const char *port);
 int server_expired(struct server *server);
 
 /**
- * Count the number of vanilla servers in the database
+ * Number of vanilla servers in the database, read from the "stats"
+ * table, see stats.h.
  */
 unsigned count_vanilla_servers(void);
 
@@ -0,0 +1,42 @@
+#include <time.h>
+
+#include "database.h"
+#include "stats.h"
+
+static void _read_stats(sqlite3_stmt *res, void *_stats)
+{
+	struct stats *stats = _stats;
+
+	stats->nplayers = sqlite3_column_int64(res, 0);
+	stats->nclans = sqlite3_column_int64(res, 1);
+	stats->nservers = sqlite3_column_int64(res, 2);
+	stats->last_ranks_update = sqlite3_column_int64(res, 3);
+	stats->ranks_update_duration = sqlite3_column_int64(res, 4);
+}
+
+int read_stats(struct stats *stats)
+{
+	static const struct stats STATS_ZERO;
+	sqlite3_stmt *res;
+	unsigned nrow;
+
+	const char *query =
+		"SELECT" ALL_STATS_COLUMNS
+		" FROM stats";
+
+	*stats = STATS_ZERO;
+	foreach_row(query, _read_stats, stats);
+
+	return res != NULL;
+}
+
+int update_ranks_stats(unsigned nplayers, unsigned duration)
+{
+	const char *query =
+		"UPDATE stats SET"
+		" nplayers = ?,"
+		" last_ranks_update = ?,"
+		" ranks_update_duration = ?";
+
+	return exec(query, "utu", nplayers, time(NULL), duration);
+}
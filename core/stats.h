@@ -0,0 +1,33 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <time.h>
+
+/*
+ * Site-wide statistics are kept in the single row "stats" table, so that
+ * pages showing them, or paginating over a list, read one row instead of
+ * counting.  It's a derived table: triggers count clans and vanilla
+ * servers as they are added or removed, and teerank-update writes the
+ * rest.
+ */
+struct stats {
+	unsigned nplayers;
+	unsigned nclans;
+	unsigned nservers;
+
+	time_t last_ranks_update;
+	unsigned ranks_update_duration;
+};
+
+#define ALL_STATS_COLUMNS \
+	" nplayers, nclans, nservers, last_ranks_update, ranks_update_duration "
+
+int read_stats(struct stats *stats);
+
+/*
+ * Record the number of ranked players, when ranks were updated and how
+ * long it took, in milliseconds.
+ */
+int update_ranks_stats(unsigned nplayers, unsigned duration);
+
+#endif /* STATS_H */
@@ -15,23 +15,33 @@
 struct config config = {
 #define STRING(envname, value, fname) \
 	.fname = value,
+#define UNSIGNED(envname, value, fname) \
+	.fname = value,
 #define BOOL(envname, value, fname) \
 	.fname = value,
 #include "config.def"
 };
 
-void init_teerank(int readonly)
+void load_config(void)
 {
 	char *tmp;
 
 #define STRING(envname, value, fname) \
 	if ((tmp = getenv(envname))) \
 		config.fname = tmp;
+#define UNSIGNED(envname, value, fname) \
+	if ((tmp = getenv(envname))) \
+		config.fname = strtoul(tmp, NULL, 10);
 #define BOOL(envname, value, fname) \
 	if ((tmp = getenv(envname))) \
 		config.fname = 1;
 
 #include "config.def"
+}
+
+void init_teerank(int readonly)
+{
+	load_config();
 
 	/* We work with UTC time only */
 	setenv("TZ", "", 1);
@@ -61,6 +71,10 @@ void init_teerank(int readonly)
 		        config.dbpath);
 		exit(EXIT_FAILURE);
 	}
+
+	/* Search indices and such can only be built with write access */
+	if (!readonly)
+		create_derived_tables();
 }
 
 void verbose(const char *fmt, ...)
@@ -70,6 +84,6 @@ void verbose(const char *fmt, ...)
 		va_start(ap, fmt);
 		vfprintf(stderr, fmt, ap);
 		va_end(ap);
-		putchar('\n');
+		fputc('\n', stderr);
 	}
 }
@@ -18,6 +18,8 @@ enum {
 struct config {
 #define STRING(envname, value, fname) \
 	char *fname;
+#define UNSIGNED(envname, value, fname) \
+	unsigned fname;
 #define BOOL(envname, value, fname) \
 	int fname;
 #include "config.def"
@@ -25,6 +27,12 @@ struct config {
 
 extern struct config config;
 
+/*
+ * Load configuration from the environment only.  This is already done
+ * by init_teerank().
+ */
+void load_config(void);
+
 /*
  * Load configuration from the environment, open the database and
  * perform some check as well.  Failure are fatal at this step so it
@@ -20,8 +20,10 @@
 #include "scheduler.h"
 #include "netclient.h"
 #include "rank.h"
+#include "ranktree.h"
 #include "packet.h"
 #include "unpacker.h"
+#include "metrics.h"
 
 static int stop;
 static void stop_gracefully(int sig)
@@ -76,48 +78,68 @@ static time_t double_expiry_date(time_t lastexpire, time_t lastseen)
 	return expire_in(t, 0);
 }
 
-/* Update clan and lastseen date of connected clients */
+static void update_rank_tree(struct player *p)
+{
+	rank_tree_insert(p->name, p->elo, p->lastseen);
+}
+
+/*
+ * Update clan, lastseen date and server of connected clients, creating
+ * the ones we never saw before, in a single query.
+ */
 static void update_players(struct server *sv)
 {
-	struct client *c;
-	unsigned i, nrow;
-	struct sqlite3_stmt *res;
+	struct player players[MAX_CLIENTS], *p;
+	time_t now = time(NULL);
+	unsigned i;
 
-	const char *exist =
-		"SELECT * FROM players WHERE name = ?";
+	for (i = 0; i < sv->num_clients; i++) {
+		p = &players[i];
+
+		snprintf(p->name, sizeof(p->name), "%s", sv->clients[i].name);
+		snprintf(p->clan, sizeof(p->clan), "%s", sv->clients[i].clan);
+		p->elo = DEFAULT_ELO;
+		p->rank = UNRANKED;
+		p->lastseen = now;
+		snprintf(p->server_ip, sizeof(p->server_ip), "%s", sv->ip);
+		snprintf(p->server_port, sizeof(p->server_port), "%s", sv->port);
+	}
 
-	const char *update =
-		"UPDATE players"
-		" SET clan = ?, lastseen = ?, server_ip = ?, server_port = ?"
-		" WHERE name = ?";
+	write_players(players, sv->num_clients, update_rank_tree);
+}
 
-	for (i = 0; i < sv->num_clients; i++) {
-		c = &sv->clients[i];
+/*
+ * Only copy what the server told us: the rest of the live state, like
+ * its master, may have changed since the answer was queued.
+ */
+static void merge_server_info(struct server *sv, struct server *info)
+{
+	unsigned i;
 
-		foreach_row(exist, NULL, NULL, "s", c->name);
+	memcpy(sv->name, info->name, sizeof(sv->name));
+	memcpy(sv->gametype, info->gametype, sizeof(sv->gametype));
+	memcpy(sv->map, info->map, sizeof(sv->map));
 
-		if (res && nrow)
-			exec(update, "stsss", c->clan, time(NULL), sv->ip, sv->port, c->name);
-		else if (res)
-			create_player(c->name, c->clan);
-	}
+	sv->num_clients = info->num_clients;
+	sv->max_clients = info->max_clients;
+	for (i = 0; i < info->num_clients; i++)
+		sv->clients[i] = info->clients[i];
 }
 
-static void handle_server_packet(struct netclient *client, struct packet *packet)
+static void handle_server_info(struct netclient *client, struct server *info, int unpacked)
 {
 	struct server old, *new;
 
 	assert(client != NULL);
-	assert(packet != NULL);
-
-	/* In any cases, we expect only one answer */
-	remove_pool_entry(&client->pentry);
+	assert(info != NULL);
 
 	old = client->info.server;
 	new = &client->info.server;
-	new->lastseen = time(NULL);
+	new->lastseen = info->lastseen;
+
+	if (unpacked) {
+		merge_server_info(new, info);
 
-	if (unpack_server_info(packet, new)) {
 		/* Update players before ranking them so that new
 		 * players are created */
 		update_players(new);
@@ -188,44 +210,59 @@ static void load_netclients(void)
 	}
 }
 
-/*
- * Set master node and service on the given server.  If the server
- * doesn't exist, create it and schedule it.
- */
-static void reference_server(char *ip, char *port, struct master *master)
+static int is_referenced_by(struct server *server, struct master *master)
 {
-	unsigned nrow;
-	sqlite3_stmt *res;
-	struct server s;
+	return strcmp(server->master_node, master->node) == 0
+		&& strcmp(server->master_service, master->service) == 0;
+}
 
+static void set_server_master(struct server *server, const char *node, const char *service)
+{
 	const char *query =
-		"SELECT" ALL_SERVER_COLUMNS
-		" FROM servers"
+		"UPDATE servers"
+		" SET master_node = ?, master_service = ?"
 		" WHERE ip = ? AND port = ?";
 
-	foreach_server(query, &s, "ss", ip, port);
+	snprintf(server->master_node, sizeof(server->master_node), "%s", node);
+	snprintf(server->master_service, sizeof(server->master_service), "%s", service);
 
-	if (!res)
-		return;
+	exec(query, "ssss", node, service, server->ip, server->port);
+}
 
-	if (!nrow) {
-		struct server server;
-		struct netclient *client;
+/*
+ * Mark the given server as listed by the given master.  If the server
+ * doesn't exist, create it and schedule it.
+ *
+ * A server listed by several masters keeps the first one, otherwise it
+ * would move from one master to another every time.  Hence the database
+ * is only written for new servers and servers without a master.
+ */
+static void reference_server(char *ip, char *port, struct netclient *mclient)
+{
+	struct master *master = &mclient->info.master;
+	struct netclient *client;
+	struct server *server;
 
-		server = create_server(ip, port, master->node, master->service);
-		client = add_netclient(NETCLIENT_TYPE_SERVER, &server);
-		if (client)
+	if (!(client = get_server_netclient(ip, port))) {
+		struct server s;
+
+		s = create_server(ip, port, master->node, master->service);
+		if ((client = add_netclient(NETCLIENT_TYPE_SERVER, &s))) {
+			client->generation = mclient->generation;
 			schedule(&client->update, 0);
+		}
 
 		return;
 	}
 
-	query =
-		"UPDATE servers"
-		" SET master_node = ?, master_service = ?"
-		" WHERE ip = ? AND port = ?";
+	server = &client->info.server;
 
-	exec(query, "ssss", master->node, master->service, ip, port);
+	if (!*server->master_node)
+		set_server_master(server, master->node, master->service);
+	else if (!is_referenced_by(server, master))
+		return;
+
+	client->generation = mclient->generation;
 }
 
 static void handle_master_packet(struct netclient *client, struct packet *packet)
@@ -237,7 +274,26 @@ static void handle_master_packet(struct netclient *client, struct packet *packet
 	assert(packet != NULL);
 
 	while (unpack_server_addr(packet, &ip, &port, &reset_context))
-		reference_server(ip, port, &client->info.master);
+		reference_server(ip, port, client);
+}
+
+/*
+ * Servers not listed by their master during its last poll shouldn't
+ * keep a dangling reference to it.  The ones still listed are counted.
+ */
+static void unreference_server(struct netclient *client, void *_mclient)
+{
+	struct netclient *mclient = _mclient;
+	struct server *server = &client->info.server;
+	struct master *master = &mclient->info.master;
+
+	if (!is_referenced_by(server, master))
+		return;
+
+	if (client->generation != mclient->generation)
+		set_server_master(server, "", "");
+	else
+		master->nservers++;
 }
 
 /*
@@ -257,23 +313,82 @@ static void handle_master_timeout(struct netclient *client)
 		master->expire = double_expiry_date(master->expire, master->lastseen);
 	}
 
+	master->nservers = 0;
+	foreach_server_netclient(unreference_server, client);
+
 	write_master(master);
 	schedule(&client->update, master->expire);
 }
 
-static void handle(struct netclient *client, struct packet *packet)
+/*
+ * Answers and timeouts are not written to the database as soon as they
+ * come, because then the write transaction would be held while waiting
+ * for the network.  Instead, answers are decoded and queued, and the
+ * queue is flushed in a single transaction when it is full or when
+ * there is nothing to receive for now.  Hence transactions are short
+ * and bounded, and readers never wait on network latency.
+ */
+#define MAX_EVENTS 256
+
+static struct event {
+	struct netclient *client;
+	int answered;
+
+	/* Decoded server info, or raw master packet */
+	int unpacked;
+	union {
+		struct server server;
+		struct packet packet;
+	} data;
+} events[MAX_EVENTS];
+
+static unsigned nr_events;
+
+static void queue_event(struct netclient *client, struct packet *packet)
 {
+	struct event *event;
+
+	assert(client != NULL);
+	assert(nr_events < MAX_EVENTS);
+
+	event = &events[nr_events++];
+	event->client = client;
+	event->answered = packet != NULL;
+
+	if (!packet)
+		return;
+
 	switch (client->type) {
 	case NETCLIENT_TYPE_SERVER:
-		if (packet)
-			handle_server_packet(client, packet);
+		/* In any cases, we expect only one answer */
+		remove_pool_entry(&client->pentry);
+
+		/* Merged into the live state when handled */
+		event->data.server.lastseen = time(NULL);
+		event->unpacked = unpack_server_info(packet, &event->data.server);
+		break;
+
+	case NETCLIENT_TYPE_MASTER:
+		event->data.packet = *packet;
+		break;
+	}
+}
+
+static void handle(struct event *event)
+{
+	struct netclient *client = event->client;
+
+	switch (client->type) {
+	case NETCLIENT_TYPE_SERVER:
+		if (event->answered)
+			handle_server_info(client, &event->data.server, event->unpacked);
 		else
 			handle_server_timeout(client);
 		break;
 
 	case NETCLIENT_TYPE_MASTER:
-		if (packet)
-			handle_master_packet(client, packet);
+		if (event->answered)
+			handle_master_packet(client, &event->data.packet);
 		else
 			handle_master_timeout(client);
 		break;
@@ -281,17 +396,38 @@ static void handle(struct netclient *client, struct packet *packet)
 }
 
 /*
- * Called before polling the given master, so that server not referenced
- * anymore don't keep a dangling reference to their old master.
+ * The rank tree follows every elo and rank written in the transaction,
+ * so when those are lost, the tree must be loaded again.
  */
-static void unreference_servers(struct master *master)
+static void commit(void)
 {
-	const char *query =
-		"UPDATE servers"
-		" SET master_node = '', master_service = ''"
-		" WHERE master_node = ? AND master_service = ?";
+	if (exec("COMMIT"))
+		return;
+
+	exec("ROLLBACK");
+	unload_rank_tree();
+}
+
+/*
+ * A netclient can't be queued after its timeout, because it is only
+ * polled again once rescheduled, hence it's safe for handlers to
+ * remove netclients.
+ */
+static void flush_events(void)
+{
+	unsigned i;
 
-	exec(query, "ss", master->node, master->service);
+	if (!nr_events)
+		return;
+
+	exec("BEGIN");
+	transaction_started();
+	for (i = 0; i < nr_events; i++)
+		handle(&events[i]);
+	commit();
+	transaction_ended();
+
+	nr_events = 0;
 }
 
 static void add_to_pool(struct netclient *client)
@@ -303,7 +439,7 @@ static void add_to_pool(struct netclient *client)
 		request = &MSG_GETINFO;
 		break;
 	case NETCLIENT_TYPE_MASTER:
-		unreference_servers(&client->info.master);
+		client->generation++;
 		request = &MSG_GETLIST;
 		break;
 	}
@@ -311,6 +447,18 @@ static void add_to_pool(struct netclient *client)
 	add_pool_entry(&client->pentry, &client->addr, request);
 }
 
+/*
+ * Ranks are updated incrementally, hence it's cheap enough to publish
+ * them every few seconds.
+ */
+#define RANKS_UPDATE_DELAY 30
+
+/*
+ * Players historic however is recorded at a slower pace, otherwise it
+ * would grow with each ranks update.
+ */
+#define HISTORIC_RECORD_DELAY (5 * 60)
+
 #define get_netclient(ptr, field) \
 	(void*)((char*)ptr - offsetof(struct netclient, field))
 
@@ -326,8 +474,11 @@ static int update(void)
 
 	struct sockets sockets;
 
-	struct job recompute_ranks_job;
-	int do_recompute_ranks = 0;
+	struct job recompute_ranks_job = { 0 };
+	struct job record_historic_job = { 0 };
+	int do_recompute_ranks = 0, do_record_historic = 0;
+
+	double start, sweep_start = 0;
 
 	if (!have_schedule())
 		return EXIT_SUCCESS;
@@ -338,39 +489,84 @@ static int update(void)
 	 * Schedule rank recomputing at the start of the program so that
 	 * brand new databases quickly have a player list with ranks.
 	 * Schedule it after a little delay to let finish masters and
-	 * servers polling.
+	 * servers polling.  The first run is a full recomputation, then
+	 * only ranks that did change are written, so it can be done
+	 * often.
 	 */
-	schedule(&recompute_ranks_job, expire_in(10, 0));
+	schedule_in(&recompute_ranks_job, 10 * 1000);
+	schedule_in(&record_historic_job, HISTORIC_RECORD_DELAY * 1000);
 
 	while (!stop) {
-		wait_until_next_schedule();
+		/* Only sleep when there are no answers to wait for */
+		if (!have_pool_entries())
+			wait_until_next_schedule();
+
+		start = metrics_clock();
 
 		while ((job = next_schedule())) {
+			/* Date 0 means as soon as possible, not late */
+			if (job->date)
+				observe(&metrics.scheduler_lag,
+				        (scheduler_clock() - job->date) / 1000);
 			if (job == &recompute_ranks_job)
 				do_recompute_ranks = 1;
+			else if (job == &record_historic_job)
+				do_record_historic = 1;
 			else
 				add_to_pool(get_netclient(job, update));
 		}
 
+		/* A sweep lasts as long as the pool has entries */
+		if (!sweep_start && have_pool_entries())
+			sweep_start = start;
+
 		/*
-		 * Batch database queries because in the worst case,
-		 * every servers will be polled.  Doing more than 1000
-		 * individual transaction is very slow.
+		 * Stop receiving answers when the next job is due, so
+		 * that jobs run on time even when polling a lot of
+		 * servers, or when the queue is full.  The pool keeps
+		 * its state until next round.
 		 */
-		exec("BEGIN");
+		while (nr_events < MAX_EVENTS
+		       && (pentry = poll_pool(&sockets, &packet, schedule_timeout())))
+			queue_event(get_netclient(pentry, pentry), packet);
+
+		flush_events();
+
+		if (sweep_start && !have_pool_entries()) {
+			observe(&metrics.sweep, metrics_clock() - sweep_start);
+			sweep_start = 0;
+		}
+
+		/*
+		 * Ranks are updated before recording historic, so that it
+		 * records ranks as they are published.
+		 */
+		if (do_recompute_ranks || do_record_historic) {
+			double ranks_start = metrics_clock();
+
+			exec("BEGIN");
+			transaction_started();
+			update_ranks();
+			if (do_record_historic)
+				record_historic();
+			commit();
+			transaction_ended();
+
+			observe(&metrics.ranks, metrics_clock() - ranks_start);
 
-		while ((pentry = poll_pool(&sockets, &packet)))
-			handle(get_netclient(pentry, pentry), packet);
+			if (do_recompute_ranks)
+				schedule_in(&recompute_ranks_job, RANKS_UPDATE_DELAY * 1000);
+			if (do_record_historic)
+				schedule_in(&record_historic_job, HISTORIC_RECORD_DELAY * 1000);
 
-		if (do_recompute_ranks) {
-			do_recompute_ranks = 0;
-			recompute_ranks();
-			schedule(&recompute_ranks_job, expire_in(5 * 60, 0));
+			do_recompute_ranks = do_record_historic = 0;
 		}
 
-		exec("COMMIT");
+		observe(&metrics.cycle, metrics_clock() - start);
+		write_metrics(0);
 	}
 
+	write_metrics(1);
 	close_sockets(&sockets);
 	return EXIT_SUCCESS;
 }
@@ -383,6 +579,7 @@ int main(int argc, char **argv)
 	}
 
 	init_teerank(0);
+	init_metrics();
 
 	signal(SIGINT,  stop_gracefully);
 	signal(SIGTERM, stop_gracefully);
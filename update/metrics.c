@@ -0,0 +1,236 @@
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "metrics.h"
+#include "teerank.h"
+#include "database.h"
+
+/* Same buckets for every durations, in seconds */
+#define DURATION_BUCKETS \
+	12, { 0.001, 0.005, 0.01, 0.05, 0.1, 0.5, 1, 5, 10, 30, 60, 300 }
+#define COUNT_BUCKETS \
+	7, { 1, 10, 100, 1000, 10000, 100000, 1000000 }
+
+struct metrics metrics = {
+	0, 0, { 0 }, 0, 0, 0,
+	{
+		"teerank_update_cycle_seconds",
+		"Time spent in a main loop iteration, waiting for answers included.",
+		DURATION_BUCKETS
+	}, {
+		"teerank_update_sweep_seconds",
+		"Time from a request to the last answer or timeout, while the pool is busy.",
+		DURATION_BUCKETS
+	}, {
+		"teerank_update_scheduler_lag_seconds",
+		"Time between the date a job was scheduled at and the date it did run.",
+		DURATION_BUCKETS
+	}, {
+		"teerank_update_transaction_seconds",
+		"Time a write transaction was held.",
+		DURATION_BUCKETS
+	}, {
+		"teerank_update_transaction_statements",
+		"Number of SQL statements run in a transaction.",
+		COUNT_BUCKETS
+	}, {
+		"teerank_update_transaction_rows",
+		"Number of rows written in a transaction.",
+		COUNT_BUCKETS
+	}, {
+		"teerank_update_ranks_seconds",
+		"Time spent updating ranks.",
+		DURATION_BUCKETS
+	}
+};
+
+int metrics_enabled;
+
+static unsigned long nstatements;
+
+/*
+ * Statements run by triggers are reported as well, prefixed by a
+ * comment, but we only want to count the ones we run.
+ */
+static int count_statement(unsigned type, void *ctx, void *p, void *x)
+{
+	if (strncmp(x, "--", 2) != 0)
+		nstatements++;
+	return 0;
+}
+
+void init_metrics(void)
+{
+	if (!*config.metrics)
+		return;
+
+	metrics_enabled = 1;
+	sqlite3_trace_v2(db, SQLITE_TRACE_STMT, count_statement, NULL);
+}
+
+void observe(struct histogram *histogram, double value)
+{
+	unsigned i;
+
+	if (!metrics_enabled)
+		return;
+
+	for (i = 0; i < histogram->nbounds; i++)
+		if (value <= histogram->bounds[i])
+			break;
+
+	histogram->buckets[i]++;
+	histogram->count++;
+	histogram->sum += value;
+}
+
+double metrics_clock(void)
+{
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) == -1)
+		return 0;
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double transaction_start;
+static unsigned long transaction_statements;
+static int transaction_changes;
+
+void transaction_started(void)
+{
+	if (!metrics_enabled)
+		return;
+
+	transaction_start = metrics_clock();
+	transaction_statements = nstatements;
+	transaction_changes = sqlite3_total_changes(db);
+}
+
+void transaction_ended(void)
+{
+	if (!metrics_enabled)
+		return;
+
+	observe(&metrics.transaction, metrics_clock() - transaction_start);
+	observe(&metrics.transaction_statements, nstatements - transaction_statements);
+	observe(&metrics.transaction_rows, sqlite3_total_changes(db) - transaction_changes);
+}
+
+static void print_counter(
+	FILE *file, const char *name, const char *help, unsigned long value)
+{
+	fprintf(file, "# HELP %s %s\n", name, help);
+	fprintf(file, "# TYPE %s counter\n", name);
+	fprintf(file, "%s %lu\n", name, value);
+}
+
+static void print_gauge(
+	FILE *file, const char *name, const char *help, unsigned long value)
+{
+	fprintf(file, "# HELP %s %s\n", name, help);
+	fprintf(file, "# TYPE %s gauge\n", name);
+	fprintf(file, "%s %lu\n", name, value);
+}
+
+static void print_histogram(FILE *file, struct histogram *histogram)
+{
+	const char *name = histogram->name;
+	unsigned long cumulative = 0;
+	unsigned i;
+
+	fprintf(file, "# HELP %s %s\n", name, histogram->help);
+	fprintf(file, "# TYPE %s histogram\n", name);
+
+	for (i = 0; i < histogram->nbounds; i++) {
+		cumulative += histogram->buckets[i];
+		fprintf(file, "%s_bucket{le=\"%g\"} %lu\n",
+		        name, histogram->bounds[i], cumulative);
+	}
+
+	fprintf(file, "%s_bucket{le=\"+Inf\"} %lu\n", name, histogram->count);
+	fprintf(file, "%s_sum %f\n", name, histogram->sum);
+	fprintf(file, "%s_count %lu\n", name, histogram->count);
+}
+
+static void print_metrics(FILE *file)
+{
+	const char *name;
+	unsigned i;
+
+	print_counter(
+		file, "teerank_update_packets_sent_total",
+		"Requests sent to masters and servers.",
+		metrics.packets_sent);
+	print_counter(
+		file, "teerank_update_packets_received_total",
+		"Answers received from masters and servers.",
+		metrics.packets_received);
+
+	name = "teerank_update_packets_lost_total";
+	fprintf(file, "# HELP %s Requests without answers, by attempt.\n", name);
+	fprintf(file, "# TYPE %s counter\n", name);
+	for (i = 0; i <= MAX_RETRIES; i++)
+		fprintf(file, "%s{attempt=\"%u\"} %lu\n",
+		        name, i, metrics.packets_lost[i]);
+
+	print_counter(
+		file, "teerank_update_requests_failed_total",
+		"Requests that still had no answers after every attempts.",
+		metrics.requests_failed);
+
+	print_gauge(
+		file, "teerank_update_pending",
+		"Requests waiting for an answer.",
+		metrics.pending);
+	print_gauge(
+		file, "teerank_update_window",
+		"Maximum number of requests waiting for an answer.",
+		metrics.window);
+
+	print_histogram(file, &metrics.cycle);
+	print_histogram(file, &metrics.sweep);
+	print_histogram(file, &metrics.scheduler_lag);
+	print_histogram(file, &metrics.transaction);
+	print_histogram(file, &metrics.transaction_statements);
+	print_histogram(file, &metrics.transaction_rows);
+	print_histogram(file, &metrics.ranks);
+}
+
+void write_metrics(int force)
+{
+	static time_t last_write;
+	char tmp[PATH_MAX];
+	FILE *file;
+	time_t now;
+
+	if (!metrics_enabled)
+		return;
+
+	now = time(NULL);
+	if (!force && now == last_write)
+		return;
+	last_write = now;
+
+	if (snprintf(tmp, sizeof(tmp), "%s.tmp", config.metrics) >= sizeof(tmp)) {
+		fprintf(stderr, "%s: Path too long\n", config.metrics);
+		return;
+	}
+
+	if (!(file = fopen(tmp, "w"))) {
+		perror(tmp);
+		return;
+	}
+
+	print_metrics(file);
+
+	/* Readers should never see a partial file */
+	if (fclose(file) != 0 || rename(tmp, config.metrics) == -1) {
+		perror(tmp);
+		unlink(tmp);
+	}
+}
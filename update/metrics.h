@@ -0,0 +1,67 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include "pool.h"
+
+/*
+ * Counters and histograms about what teerank-update is doing, written
+ * in the Prometheus text format to the file TEERANK_METRICS names.
+ * The file is rewritten as a whole and renamed over the previous one,
+ * so readers never see a partial file.  Nothing is measured when
+ * TEERANK_METRICS is empty.
+ */
+
+#define MAX_BUCKETS 12
+
+struct histogram {
+	const char *name, *help;
+
+	/* Upper bounds of buckets, the last one is implicitly +Inf */
+	unsigned nbounds;
+	double bounds[MAX_BUCKETS];
+
+	unsigned long buckets[MAX_BUCKETS + 1];
+	unsigned long count;
+	double sum;
+};
+
+extern struct metrics {
+	/* Requests sent, answers received and requests lost per attempt */
+	unsigned long packets_sent;
+	unsigned long packets_received;
+	unsigned long packets_lost[MAX_RETRIES + 1];
+	unsigned long requests_failed;
+
+	/* Pool state, sampled at each cycle */
+	unsigned pending, window;
+
+	struct histogram cycle;
+	struct histogram sweep;
+	struct histogram scheduler_lag;
+	struct histogram transaction;
+	struct histogram transaction_statements;
+	struct histogram transaction_rows;
+	struct histogram ranks;
+} metrics;
+
+/* Nonzero when metrics are enabled */
+extern int metrics_enabled;
+
+void init_metrics(void);
+
+void observe(struct histogram *histogram, double value);
+
+/* Monotonic time in seconds, to compute durations */
+double metrics_clock(void);
+
+/*
+ * Count statements and rows written between the two calls, and how
+ * long the transaction was held.
+ */
+void transaction_started(void);
+void transaction_ended(void);
+
+/* Rewrite the metrics file, at most once per second unless forced */
+void write_metrics(int force);
+
+#endif /* METRICS_H */
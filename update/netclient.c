@@ -1,10 +1,84 @@
+#include <string.h>
+
 #include "netclient.h"
 
 #define MAX_NETCLIENTS 4096
 
+/* Size is a power of two */
+#define NBUCKETS 4096
+
 static struct netclient netclients[MAX_NETCLIENTS];
 static struct netclient *nextfree;
 
+static struct netclient *buckets[NBUCKETS];
+
+static unsigned hash_server(const char *ip, const char *port)
+{
+	unsigned h = 2166136261u;
+
+	/* FNV-1a, with the NUL in between so "1.2.3.4" "5" != "1.2.3.45" "" */
+	do
+		h = (h ^ (unsigned char)*ip) * 16777619u;
+	while (*ip++);
+
+	while (*port)
+		h = (h ^ (unsigned char)*port++) * 16777619u;
+
+	return h & (NBUCKETS - 1);
+}
+
+static void hash_netclient(struct netclient *netclient)
+{
+	struct server *server = &netclient->info.server;
+	unsigned b = hash_server(server->ip, server->port);
+
+	netclient->hnext = buckets[b];
+	buckets[b] = netclient;
+}
+
+static void unhash_netclient(struct netclient *netclient)
+{
+	struct server *server = &netclient->info.server;
+	struct netclient **it;
+
+	it = &buckets[hash_server(server->ip, server->port)];
+	for (; *it; it = &(*it)->hnext) {
+		if (*it == netclient) {
+			*it = netclient->hnext;
+			return;
+		}
+	}
+}
+
+struct netclient *get_server_netclient(const char *ip, const char *port)
+{
+	struct netclient *netclient;
+	struct server *server;
+
+	netclient = buckets[hash_server(ip, port)];
+	for (; netclient; netclient = netclient->hnext) {
+		server = &netclient->info.server;
+		if (strcmp(server->ip, ip) == 0 && strcmp(server->port, port) == 0)
+			return netclient;
+	}
+
+	return NULL;
+}
+
+void foreach_server_netclient(void (*func)(struct netclient *, void *), void *data)
+{
+	struct netclient *netclient, *next;
+	unsigned i;
+
+	/* func() is allowed to remove the given netclient */
+	for (i = 0; i < NBUCKETS; i++) {
+		for (netclient = buckets[i]; netclient; netclient = next) {
+			next = netclient->hnext;
+			func(netclient, data);
+		}
+	}
+}
+
 /* Build freelist */
 static void init(void)
 {
@@ -70,11 +144,17 @@ struct netclient *add_netclient(enum netclient_type type, void *info)
 	}
 
 	netclient->type = type;
+	if (type == NETCLIENT_TYPE_SERVER)
+		hash_netclient(netclient);
+
 	return netclient;
 }
 
 void remove_netclient(struct netclient *netclient)
 {
+	if (netclient->type == NETCLIENT_TYPE_SERVER)
+		unhash_netclient(netclient);
+
 	netclient->nextfree = nextfree;
 	nextfree = netclient;
 }
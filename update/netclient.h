@@ -22,10 +22,27 @@ struct netclient {
 		struct master master;
 	} info;
 
+	/*
+	 * For masters, incremented each time the server list is
+	 * requested.  For servers, generation of their master the last
+	 * time it did list them.
+	 */
+	unsigned generation;
+
 	struct netclient *nextfree;
+
+	/* Next server netclient in the same hash bucket */
+	struct netclient *hnext;
 };
 
 struct netclient *add_netclient(enum netclient_type type, void *info);
 void remove_netclient(struct netclient *netclient);
 
+/*
+ * Server netclients are indexed by address, so that master lists can
+ * be checked against known servers without querying the database.
+ */
+struct netclient *get_server_netclient(const char *ip, const char *port);
+void foreach_server_netclient(void (*func)(struct netclient *, void *), void *data);
+
 #endif /* NETCLIENT_H */
@@ -12,6 +12,19 @@
 
 #include "packet.h"
 
+/*
+ * When many requests are in flight, answers can come faster than we
+ * read them.  A bigger receive buffer avoids dropping them, it doesn't
+ * matter if the system refuses it though.
+ */
+#define RECV_BUFFER_SIZE (1 << 20)
+
+static void grow_recv_buffer(int fd)
+{
+	int size = RECV_BUFFER_SIZE;
+	setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+}
+
 int init_sockets(struct sockets *sockets)
 {
 	assert(sockets != NULL);
@@ -29,6 +42,9 @@ int init_sockets(struct sockets *sockets)
 		return 0;
 	}
 
+	grow_recv_buffer(sockets->ipv4.fd);
+	grow_recv_buffer(sockets->ipv6.fd);
+
 	return 1;
 }
 
@@ -92,10 +108,10 @@ int send_packet(
 
 int recv_packet(
 	struct sockets *sockets, struct packet *packet,
-	struct sockaddr_storage *addr)
+	struct sockaddr_storage *addr, int timeout)
 {
 	unsigned char buf[CONNLESS_PACKET_SIZE];
-	socklen_t addrlen = sizeof(addr);
+	socklen_t addrlen = sizeof(*addr);
 	ssize_t ret;
 	int fd;
 
@@ -108,7 +124,7 @@ int recv_packet(
 	/* Poll ipv4 and ipv6 sockets */
 	sockets->ipv4.events = POLLIN;
 	sockets->ipv6.events = POLLIN;
-	ret = poll((struct pollfd*)sockets, 2, 1000);
+	ret = poll((struct pollfd*)sockets, 2, timeout);
 
 	if (ret == -1) {
 		if (errno != EINTR)
@@ -163,25 +179,10 @@ int get_sockaddr(char *node, char *service, struct sockaddr_storage *addr)
 		return 0;
 	}
 
-	/* Assume the first one works */
-	*(struct sockaddr*)addr = *res->ai_addr;
+	/* Assume the first one works, copy all of it for IPv6 */
+	memset(addr, 0, sizeof(*addr));
+	memcpy(addr, res->ai_addr, res->ai_addrlen);
 
 	freeaddrinfo(res);
 	return 1;
 }
-
-int skip_header(struct packet *packet, const uint8_t *header, size_t size)
-{
-	assert(packet != NULL);
-	assert(header != NULL);
-	assert(size > 0);
-
-	if (packet->size < size)
-		return 0;
-	if (memcmp(packet->buffer, header, size) != 0)
-		return 0;
-
-	packet->size -= size;
-	memmove(packet->buffer, &packet->buffer[size], packet->size);
-	return 1;
-}
@@ -9,7 +9,7 @@
  * Teeworlds works with UDP, over ipv4 and ipv6 so two sockets are
  * needed.  That's the purpose of struct socket.  Since we must have
  * some sort of timeout when waiting for data, recv_packet() actually
- * use poll().
+ * use poll(), with the given timeout in milliseconds.
  *
  * A struct packet represent data without connless packet header.  Since
  * we only work with connless packet, we ignore their header right away.
@@ -42,13 +42,12 @@ int init_sockets(struct sockets *sockets);
 void close_sockets(struct sockets *sockets);
 
 int get_sockaddr(char *node, char *service, struct sockaddr_storage *addr);
-int skip_header(struct packet *packet, const uint8_t *header, size_t size);
 
 int send_packet(
 	struct sockets *sockets, const struct packet *packet,
 	struct sockaddr_storage *addr);
 int recv_packet(
 	struct sockets *sockets, struct packet *packet,
-	struct sockaddr_storage *addr);
+	struct sockaddr_storage *addr, int timeout);
 
 #endif /* PACKET_H */
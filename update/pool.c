@@ -1,22 +1,46 @@
 #include <stdlib.h>
 #include <assert.h>
-#include <sys/times.h>
+#include <time.h>
 #include <unistd.h>
 #include <string.h>
 #include <netdb.h>
 
 #include "pool.h"
 #include "packet.h"
+#include "metrics.h"
 
-#define MAX_PENDING 25
-#define MAX_RETRIES 2
 #define MAX_PING 999
 
+/*
+ * Bounds for the number of requests in flight.  The lower bound is what
+ * used to be the fixed limit, and we never go below it even if a lot of
+ * requests are lost, because most of the time they are lost for good:
+ * the server just went offline.
+ */
+#define MIN_WINDOW 25
+#define MAX_WINDOW 1024
+
+/* Pending entries are found by address, size is a power of two */
+#define NBUCKETS 2048
+
 static struct pool_entry *idle, *idletail;
-static struct pool_entry *pending;
+static struct pool_entry *pending, *pendingtail;
 static struct pool_entry *failed;
 static unsigned nr_pending;
 
+static struct pool_entry *buckets[NBUCKETS];
+
+/*
+ * In flight window, grows by one each time an answer comes until the
+ * first loss, then by one every "window" answers.  Halved on losses,
+ * but at most once per MAX_PING because a burst of losses is usually
+ * caused by a single congestion event.
+ */
+static unsigned window = MIN_WINDOW;
+static unsigned threshold = MAX_WINDOW;
+static unsigned nanswers;
+static unsigned long last_loss;
+
 /*
  * Helpers to insert and remove a given entry from the given double
  * linked list.  Since this operation can be tricky we better have to
@@ -59,14 +83,93 @@ static void remove_entry(
 }
 
 /*
- * Should work even if the current iterated entry is moved to another
- * list (hence making ->next meaningless for the current loop).
+ * Monotonic time in milliseconds.  times() was used before but its
+ * resolution is system dependant and it wraps around quickly.
  */
-#define list_foreach(list, it, _next) for ( \
-	it = list; \
-	_next = (it ? it->next : NULL), it; \
-	it = _next \
-)
+static unsigned long now(void)
+{
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) == -1)
+		return 0;
+
+	return ts.tv_sec * 1000UL + ts.tv_nsec / 1000000;
+}
+
+static unsigned hash_addr(struct sockaddr_storage *addr)
+{
+	const unsigned char *bytes;
+	unsigned h = 2166136261u;
+	size_t i, size;
+	in_port_t port;
+
+	assert(addr->ss_family == AF_INET || addr->ss_family == AF_INET6);
+
+	if (addr->ss_family == AF_INET) {
+		bytes = (unsigned char*)&((struct sockaddr_in*)addr)->sin_addr;
+		size = sizeof(struct in_addr);
+		port = ((struct sockaddr_in*)addr)->sin_port;
+	} else {
+		bytes = (unsigned char*)&((struct sockaddr_in6*)addr)->sin6_addr;
+		size = sizeof(struct in6_addr);
+		port = ((struct sockaddr_in6*)addr)->sin6_port;
+	}
+
+	/* FNV-1a */
+	for (i = 0; i < size; i++)
+		h = (h ^ bytes[i]) * 16777619u;
+	h = (h ^ (port & 0xff)) * 16777619u;
+	h = (h ^ (port >> 8)) * 16777619u;
+
+	return h & (NBUCKETS - 1);
+}
+
+static void hash_entry(struct pool_entry *entry)
+{
+	unsigned b = hash_addr(entry->addr);
+
+	entry->hnext = buckets[b];
+	buckets[b] = entry;
+}
+
+static void unhash_entry(struct pool_entry *entry)
+{
+	struct pool_entry **it;
+
+	for (it = &buckets[hash_addr(entry->addr)]; *it; it = &(*it)->hnext) {
+		if (*it == entry) {
+			*it = entry->hnext;
+			return;
+		}
+	}
+}
+
+static void got_answer(void)
+{
+	if (window >= MAX_WINDOW)
+		return;
+
+	if (window < threshold) {
+		window++;
+	} else if (++nanswers >= window) {
+		nanswers = 0;
+		window++;
+	}
+}
+
+static void got_loss(unsigned long t)
+{
+	if (t - last_loss < MAX_PING)
+		return;
+
+	last_loss = t;
+	nanswers = 0;
+
+	threshold = window / 2;
+	if (threshold < MIN_WINDOW)
+		threshold = MIN_WINDOW;
+	window = threshold;
+}
 
 void add_pool_entry(
 	struct pool_entry *entry,
@@ -88,16 +191,22 @@ static void entry_expired(struct pool_entry *entry)
 {
 	if (entry->retries == MAX_RETRIES) {
 		insert_entry(entry, &failed, NULL);
+		if (!entry->polled)
+			metrics.requests_failed++;
 	} else {
 		insert_entry(entry, &idle, &idletail);
 		entry->retries++;
 	}
 }
 
+/*
+ * Pending entries are kept sorted by start time, the oldest being the
+ * tail, so that expired entries are found without looking at others.
+ */
 static void add_pending_entry(struct sockets *sockets, struct pool_entry *entry)
 {
 	assert(entry != NULL);
-	assert(nr_pending < MAX_PENDING);
+	assert(nr_pending < window);
 
 	remove_entry(entry, &idle, &idletail);
 
@@ -106,47 +215,57 @@ static void add_pending_entry(struct sockets *sockets, struct pool_entry *entry)
 		return;
 	}
 
-	entry->start_time = times(NULL);
+	entry->start_time = now();
+	metrics.packets_sent++;
 
-	insert_entry(entry, &pending, NULL);
+	insert_entry(entry, &pending, &pendingtail);
+	hash_entry(entry);
 	nr_pending++;
 }
 
 void remove_pool_entry(struct pool_entry *entry)
 {
-	remove_entry(entry, &pending, NULL);
+	remove_entry(entry, &pending, &pendingtail);
+	unhash_entry(entry);
 	nr_pending--;
 }
 
 static void fill_pending_list(struct sockets *sockets)
 {
-	while (idletail && nr_pending < MAX_PENDING)
+	while (idletail && nr_pending < window)
 		add_pending_entry(sockets, idletail);
 }
 
 static void clean_expired_pending_entries(void)
 {
-	static long ticks_per_second = -1;
-	struct pool_entry *entry, *next;
-	clock_t now;
+	struct pool_entry *entry;
+	unsigned long t = now();
+
+	while ((entry = pendingtail) && t - entry->start_time >= MAX_PING) {
+		/*
+		 * Entries that did answer and then stopped are just
+		 * done (masters send several packets), not lost.
+		 */
+		if (!entry->polled) {
+			got_loss(t);
+			metrics.packets_lost[entry->retries]++;
+		}
 
-	/* Set ticks_per_seconds once for all */
-	if (ticks_per_second == -1)
-		ticks_per_second = sysconf(_SC_CLK_TCK);
-	assert(ticks_per_second != -1);
+		remove_pool_entry(entry);
+		entry_expired(entry);
+	}
+}
 
-	now = times(NULL);
+/* Milliseconds until the oldest pending entry expires */
+static int next_timeout(void)
+{
+	unsigned long elapsed;
 
-	list_foreach(pending, entry, next) {
-		/* In seconds */
-		float elapsed = (now - entry->start_time) / ticks_per_second;
+	if (!pendingtail)
+		return MAX_PING;
 
-		if (elapsed >= MAX_PING / 1000.0f) {
-			remove_entry(entry, &pending, NULL);
-			nr_pending--;
-			entry_expired(entry);
-		}
-	}
+	elapsed = now() - pendingtail->start_time;
+	return elapsed >= MAX_PING ? 0 : MAX_PING - elapsed;
 }
 
 static int is_same_addr(
@@ -185,17 +304,28 @@ static int is_same_addr(
 static struct pool_entry *get_pending_entry(
 	struct sockaddr_storage *addr)
 {
-	struct pool_entry *entry, *next;
+	struct pool_entry *entry;
 
 	assert(addr != NULL);
 
-	list_foreach(pending, entry, next)
+	if (addr->ss_family != AF_INET && addr->ss_family != AF_INET6)
+		return NULL;
+
+	for (entry = buckets[hash_addr(addr)]; entry; entry = entry->hnext)
 		if (is_same_addr(addr, entry->addr))
 			break;
 
 	if (entry) {
+		metrics.packets_received++;
+		if (!entry->polled)
+			got_answer();
+
 		entry->polled = 1;
-		entry->start_time = times(NULL);
+		entry->start_time = now();
+
+		/* Restarted, hence it is now the most recent one */
+		remove_entry(entry, &pending, &pendingtail);
+		insert_entry(entry, &pending, &pendingtail);
 	}
 
 	return entry;
@@ -217,14 +347,27 @@ static struct pool_entry *next_failed_entry(struct sockets *sockets)
 	return entry;
 }
 
-struct pool_entry *poll_pool(struct sockets *sockets, struct packet **_packet)
+int have_pool_entries(void)
+{
+	return idle || pending || failed;
+}
+
+struct pool_entry *poll_pool(
+	struct sockets *sockets, struct packet **_packet, int timeout)
 {
 	static struct packet packet;
 	struct sockaddr_storage addr;
 	struct pool_entry *entry = NULL;
+	unsigned long deadline;
+	int wait;
 
 	assert(_packet != NULL);
 
+	deadline = now() + (timeout < 0 ? 0 : timeout);
+
+	metrics.pending = nr_pending;
+	metrics.window = window;
+
 again:
 	fill_pending_list(sockets);
 	if ((entry = next_failed_entry(sockets))) {
@@ -233,7 +376,19 @@ again:
 	}
 
 	if (pending) {
-		if (recv_packet(sockets, &packet, &addr))
+		/*
+		 * Don't wait longer than needed: when the oldest entry
+		 * expires, a slot is freed for the next request.
+		 */
+		wait = next_timeout();
+		if (timeout >= 0) {
+			if (now() >= deadline)
+				return NULL;
+			if (deadline - now() < wait)
+				wait = deadline - now();
+		}
+
+		if (recv_packet(sockets, &packet, &addr, wait))
 			entry = get_pending_entry(&addr);
 
 		if (entry) {
@@ -11,7 +11,9 @@
  * When receiving too much data over UDP, some of them will be lost.  One way
  * to mitigate the issue is to send request to a subset of x servers at a time.
  * That way, even if all answers comes at the same time, they won't fill
- * the bandwidth and just a few of them will be droped.
+ * the bandwidth and just a few of them will be droped.  The size of that
+ * subset is not fixed: it grows as long as answers come back, and it is
+ * halved when requests start to be lost, like TCP congestion window.
  *
  * Another way the pool deal with lost packets is by resending request after
  * some time.  A pool also have a timeout for each request send, so it can
@@ -20,6 +22,9 @@
 
 #include "packet.h"
 
+/* Requests are sent again that many times before giving up */
+#define MAX_RETRIES 2
+
 /**
  * @struct pool_entry
  *
@@ -33,9 +38,14 @@ struct pool_entry {
 
 	unsigned retries;
 	short polled;
-	clock_t start_time;
+
+	/* In milliseconds, see now() */
+	unsigned long start_time;
 
 	struct pool_entry *next, *prev;
+
+	/* Next pending entry in the same hash bucket */
+	struct pool_entry *hnext;
 };
 
 /**
@@ -65,9 +75,19 @@ void remove_pool_entry(struct pool_entry *pentry);
  *
  * @param sockets Sockets to send to and receive from
  * @param Received answer (if any) for the returned entry (if any)
+ * @param timeout Give up after the given milliseconds, -1 to only
+ *                return once the pool is empty
  *
  * @return Polled entry, NULL if any
  */
-struct pool_entry *poll_pool(struct sockets *socket, struct packet **packet);
+struct pool_entry *poll_pool(
+	struct sockets *socket, struct packet **packet, int timeout);
+
+/**
+ * Check if the pool still have entries to poll.
+ *
+ * @return 1 if there is still work to do, 0 otherwise
+ */
+int have_pool_entries(void);
 
 #endif /* POOL_H */
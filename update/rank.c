@@ -39,6 +39,15 @@
  * I'm not really familiar with relational databases yet so I could have
  * missed an obvious solution.  For now, this seems to work better than
  * everything else I tried.  Fingers crossed.
+ *
+ * Update: the database is not the only place where we can rank
+ * players.  teerank-update now keep every players in memory, in a tree
+ * ordered by elo where each node knows the size of its subtree (see
+ * ranktree.c).  Rank of any player is then a O(log n) lookup, and
+ * moving a player in the tree is O(log n) too.  Hence when pending elo
+ * are applied, we know exactly which ranks did change and only write
+ * those.  That's cheap enough to be done every few seconds, so ranks
+ * are back to near real time.
  */
 
 #include <stdio.h>
@@ -49,7 +58,9 @@
 
 #include "teerank.h"
 #include "rank.h"
+#include "ranktree.h"
 #include "player.h"
+#include "stats.h"
 #include "database.h"
 
 /*
@@ -73,18 +84,6 @@ static struct client *find_client(struct server *server, const char *pname)
 	return NULL;
 }
 
-static int is_already_loaded(struct player *players, const char *pname)
-{
-	unsigned i;
-	struct player *p;
-
-	_foreach_player(p)
-		if (strcmp(p->name, pname) == 0)
-			return 1;
-
-	return 0;
-}
-
 struct pending {
 	const char *name;
 	int elo;
@@ -97,57 +96,47 @@ static void read_pending(struct sqlite3_stmt *res, void *_p)
 	p->elo = sqlite3_column_int(res, 1);
 }
 
-/* Returns pending elo, if any */
-static int get_latest_elo(struct player *player)
-{
-	unsigned nrow;
-	sqlite3_stmt *res;
-	struct pending pending;
-
-	const char *query =
-		"SELECT name, elo"
-		" FROM pending"
-		" WHERE name = ?";
-
-	foreach_row(query, read_pending, &pending, "s", player->name);
-	if (!res || !nrow)
-		return player->elo;
-	else
-		return pending.elo;
-}
-
 /*
- * This loads every players in the "new" server.  One subtlety tho: we
- * are gonna rank those players, and for this purpose, we needs the
- * latest elo score available.  That's why we retrieve the elo score
- * from the "pending" table, if any.
+ * This loads every players in the "new" server, with a single query.
+ * One subtlety tho: we are gonna rank those players, and for this
+ * purpose, we needs the latest elo score available.  That's why we
+ * retrieve the elo score from the "pending" table, if any.
+ *
+ * Duplicated names in the server are loaded once since names are
+ * unique in the players table.
  */
 static void load_players(struct server *old, struct server *new, struct player *players)
 {
+	char query[512];
 	unsigned i, nrow;
 	sqlite3_stmt *res;
-	char *pname;
-
-	const char *query =
-		"SELECT" ALL_PLAYER_COLUMNS
-		" FROM players"
-		" WHERE name = ?";
-
-	for (i = 0; i < new->num_clients; i++) {
-		pname = new->clients[i].name;
-
-		/* Don't load duplicated players */
-		if (is_already_loaded(players, pname))
-			continue;
-
-		foreach_player(query, players, "s", pname);
-		if (!res || !nrow)
-			continue;
-
-		players->new = &new->clients[i];
-		players->old = find_client(old, pname);
-		players->elo = get_latest_elo(players);
+	int len;
+
+	if (!new->num_clients)
+		return;
+
+	len = snprintf(query, sizeof(query),
+		"SELECT players.name, clan, COALESCE(pending.elo, players.elo),"
+		"       rank, lastseen, server_ip, server_port"
+		" FROM players LEFT JOIN pending"
+		"  ON pending.name = players.name"
+		" WHERE players.name IN (");
+	for (i = 0; i < new->num_clients; i++)
+		len += snprintf(query + len, sizeof(query) - len, "%s?", i ? ", " : "");
+	snprintf(query + len, sizeof(query) - len, ")");
+
+	res = foreach_init(query, "");
+	for (i = 0; res && i < new->num_clients; i++) {
+		if (sqlite3_bind_text(res, i + 1, new->clients[i].name, -1, SQLITE_STATIC) != SQLITE_OK) {
+			fprintf(stderr, "load_players(): Cannot bind %s\n", new->clients[i].name);
+			foreach_end(res);
+			res = NULL;
+		}
+	}
 
+	for (nrow = 0; foreach_next(&res, players, read_player); nrow++) {
+		players->new = find_client(new, players->name);
+		players->old = find_client(old, players->name);
 		players++;
 	}
 }
@@ -369,11 +358,13 @@ void rank_players(struct server *old, struct server *new)
 
 /*
  * Take every pending changes in the "pending" table and definitively
- * commit them in the database.
+ * commit them in the database.  Pending changes are kept until
+ * record_historic(), so most of them may already be applied: only
+ * write elos that did change.  Returns the number of elos written.
  */
-static void apply_pending_elo(void)
+static unsigned apply_pending_elo(void)
 {
-	unsigned nrow;
+	unsigned nrow, applied = 0;
 	sqlite3_stmt *res;
 	struct pending p;
 
@@ -381,8 +372,14 @@ static void apply_pending_elo(void)
 		"SELECT name, elo"
 		" FROM pending";
 
-	foreach_row(query, read_pending, &p)
-		exec("UPDATE players SET elo = ? WHERE name = ?", "is", p.elo, p.name);
+	foreach_row(query, read_pending, &p) {
+		if (exec("UPDATE players SET elo = ? WHERE name = ? AND elo <> ?",
+		         "isi", p.elo, p.name, p.elo))
+			applied += sqlite3_changes(db);
+		rank_tree_set_elo(p.name, p.elo);
+	}
+
+	return applied;
 }
 
 /*
@@ -390,7 +387,7 @@ static void apply_pending_elo(void)
  * then flush the pending table.  This does not write new elo in players
  * records, this is done by apply_pending_elo().
  */
-static void record_changes(void)
+void record_historic(void)
 {
 	unsigned nrow;
 	sqlite3_stmt *res;
@@ -415,23 +412,70 @@ static void read_name_and_elo(sqlite3_stmt *res, void *_p)
 }
 
 /*
- * This is were we actually recompute ranks of every players in the
- * database.  Not sure yet if it is the faster way to do it.  Verbose
- * time consumed because this is easily the most expensive query in the
- * whole project.
+ * Write ranks one player at a time, following elo order.  Each update
+ * is a lookup by name, so this is O(n log n) and quite slow on big
+ * databases.  Returns the number of players.
  */
-void recompute_ranks(void)
+static unsigned write_ranks_one_by_one(void)
 {
 	unsigned nrow;
 	sqlite3_stmt *res;
 	struct player p;
-	clock_t clk;
 
 	const char *query =
 		"SELECT name, elo"
 		" FROM players"
 		" ORDER BY" SORT_BY_ELO;
 
+	foreach_row(query, read_name_and_elo, &p) {
+		p.rank = nrow+1;
+		exec("UPDATE players SET rank = ? WHERE name = ?", "us", p.rank, p.name);
+	}
+
+	return nrow;
+}
+
+/*
+ * Let SQLite compute every ranks at once with a window function, store
+ * them in a temporary table, and then apply them with a single UPDATE.
+ * Only rows whose rank actually changed are written.  Returns the
+ * number of players.
+ */
+static unsigned write_ranks_in_bulk(void)
+{
+	unsigned nplayers;
+
+	exec("DROP TABLE IF EXISTS temp.ranks");
+	exec("CREATE TEMP TABLE ranks(name TEXT PRIMARY KEY, rank INTEGER) WITHOUT ROWID");
+
+	exec(
+		"INSERT INTO temp.ranks"
+		" SELECT name, ROW_NUMBER() OVER (ORDER BY" SORT_BY_ELO ")"
+		" FROM players");
+	nplayers = sqlite3_changes(db);
+
+	exec(
+		"UPDATE players"
+		" SET rank = ranks.rank"
+		" FROM temp.ranks AS ranks"
+		" WHERE players.name = ranks.name AND players.rank <> ranks.rank");
+
+	exec("DROP TABLE temp.ranks");
+	return nplayers;
+}
+
+/*
+ * This is were we actually recompute ranks of every players in the
+ * database.  Not sure yet if it is the faster way to do it, hence the
+ * two strategies, selected with TEERANK_BULK_RANKS.  Verbose time
+ * consumed because this is easily the most expensive query in the
+ * whole project.
+ */
+void recompute_ranks(void)
+{
+	unsigned nplayers, ms;
+	clock_t clk;
+
 	clk = clock();
 
 	apply_pending_elo();
@@ -443,17 +487,60 @@ void recompute_ranks(void)
 	 */
 	drop_all_indices();
 
-	foreach_row(query, read_name_and_elo, &p) {
-		p.rank = nrow+1;
-		exec("UPDATE players SET rank = ? WHERE name = ?", "us", p.rank, p.name);
-	}
+	if (config.bulk_ranks)
+		nplayers = write_ranks_in_bulk();
+	else
+		nplayers = write_ranks_one_by_one();
 
 	create_all_indices();
 
-	record_changes();
+	record_historic();
 
 	clk = clock() - clk;
-	verbose(
-		"Recomputing ranks for %u players took %ums",
-		nrow, (unsigned)((double)clk / CLOCKS_PER_SEC * 1000.0));
+	ms = (double)clk / CLOCKS_PER_SEC * 1000.0;
+	update_ranks_stats(nplayers, ms);
+
+	if (config.bulk_ranks)
+		verbose(
+			"Recomputing ranks for %u players in bulk took %ums",
+			nplayers, ms);
+	else
+		verbose(
+			"Recomputing ranks for %u players took %ums",
+			nplayers, ms);
+
+	/* Ranks are now consistent, the tree can be (re)loaded */
+	load_rank_tree();
+}
+
+/*
+ * Ranks are kept up to date in memory by the rank tree, so once pending
+ * elo are applied, only ranks that did change are written.  When the
+ * tree is not loaded yet, we don't know which ranks are stale: do a full
+ * recomputation instead, it will load the tree.  Nothing is written when
+ * nothing did change, so that the database is left untouched.
+ */
+void update_ranks(void)
+{
+	unsigned applied, changed, ms;
+	clock_t clk;
+
+	if (!is_rank_tree_loaded()) {
+		recompute_ranks();
+		return;
+	}
+
+	clk = clock();
+
+	applied = apply_pending_elo();
+	changed = publish_ranks();
+
+	if (!applied && !changed)
+		return;
+
+	clk = clock() - clk;
+	ms = (double)clk / CLOCKS_PER_SEC * 1000.0;
+	update_ranks_stats(rank_tree_size(), ms);
+
+	verbose("Updating %u ranks took %ums", changed, ms);
 }
@@ -16,4 +16,18 @@ void rank_players(struct server *old, struct server *new);
  */
 void recompute_ranks(void);
 
+/*
+ * Same as recompute_ranks(), but only write ranks that did change since
+ * last call, using the in-memory rank tree.  Fallback to
+ * recompute_ranks() when the tree is not loaded.  Unlike
+ * recompute_ranks(), this does not record players historic.
+ */
+void update_ranks(void);
+
+/*
+ * Record elo and rank of players with pending changes in their
+ * historic, and flush pending changes.  Ranks should be up to date.
+ */
+void record_historic(void);
+
 #endif /* RANK_H */
@@ -0,0 +1,507 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+
+#include "ranktree.h"
+#include "database.h"
+#include "player.h"
+
+/*
+ * The tree is a treap: a binary search tree ordered by players keys,
+ * where each node also has a random priority and is a heap with
+ * respect to those priorities.  It keeps the tree balanced on average
+ * without the bookkeeping of red-black trees.
+ *
+ * Nodes live in a single growable array and refer to each others using
+ * indices, index 0 being the empty tree.  Nodes are never removed
+ * because players are never removed either.
+ */
+struct node {
+	char name[NAME_LENGTH];
+	int elo;
+	time_t lastseen;
+
+	/* Rank currently stored in the database, 0 if none */
+	unsigned published;
+
+	unsigned size;
+	unsigned prio;
+	unsigned left, right;
+
+	/* Next node in the same hash bucket */
+	unsigned hnext;
+
+	/* Next node whose rank may have changed */
+	unsigned dirtynext;
+	int is_dirty;
+};
+
+static struct node *nodes;
+static unsigned nnodes, maxnodes;
+static unsigned root;
+
+/* Find nodes given a player name, chained, size is a power of two */
+static unsigned *buckets;
+static unsigned nbuckets;
+
+static unsigned dirty;
+static int loaded;
+
+static unsigned hash(const char *name)
+{
+	unsigned h = 2166136261u;
+
+	while (*name)
+		h = (h ^ (unsigned char)*name++) * 16777619u;
+
+	return h;
+}
+
+static unsigned random_priority(void)
+{
+	static unsigned long seed = 1;
+
+	seed = seed * 1103515245 + 12345;
+	return (unsigned)(seed >> 16);
+}
+
+static void unload(void)
+{
+	free(nodes);
+	free(buckets);
+
+	nodes = NULL;
+	buckets = NULL;
+	nnodes = maxnodes = nbuckets = 0;
+	root = dirty = 0;
+	loaded = 0;
+}
+
+/* Order nodes using the same criteria than SORT_BY_ELO */
+static int cmp(struct node *a, struct node *b)
+{
+	if (a->elo != b->elo)
+		return a->elo > b->elo ? -1 : 1;
+	if (a->lastseen != b->lastseen)
+		return a->lastseen > b->lastseen ? -1 : 1;
+	return -strcmp(a->name, b->name);
+}
+
+static void update_size(unsigned t)
+{
+	nodes[t].size = 1 + nodes[nodes[t].left].size + nodes[nodes[t].right].size;
+}
+
+/* Split t in two trees: nodes before k in *l, and the others in *r */
+static void split(unsigned t, struct node *k, unsigned *l, unsigned *r)
+{
+	if (!t) {
+		*l = *r = 0;
+		return;
+	}
+
+	if (cmp(&nodes[t], k) < 0) {
+		split(nodes[t].right, k, &nodes[t].right, r);
+		*l = t;
+	} else {
+		split(nodes[t].left, k, l, &nodes[t].left);
+		*r = t;
+	}
+
+	update_size(t);
+}
+
+/* Every nodes in l must be before nodes in r */
+static unsigned merge(unsigned l, unsigned r)
+{
+	if (!l)
+		return r;
+	if (!r)
+		return l;
+
+	if (nodes[l].prio > nodes[r].prio) {
+		nodes[l].right = merge(nodes[l].right, r);
+		update_size(l);
+		return l;
+	} else {
+		nodes[r].left = merge(l, nodes[r].left);
+		update_size(r);
+		return r;
+	}
+}
+
+static void insert(unsigned n)
+{
+	unsigned l, r;
+
+	nodes[n].left = nodes[n].right = 0;
+	nodes[n].size = 1;
+
+	split(root, &nodes[n], &l, &r);
+	root = merge(merge(l, n), r);
+}
+
+/* The given node must be in the tree */
+static unsigned erase(unsigned t, struct node *k)
+{
+	int c;
+
+	assert(t);
+
+	c = cmp(k, &nodes[t]);
+	if (c == 0)
+		return merge(nodes[t].left, nodes[t].right);
+
+	if (c < 0)
+		nodes[t].left = erase(nodes[t].left, k);
+	else
+		nodes[t].right = erase(nodes[t].right, k);
+
+	update_size(t);
+	return t;
+}
+
+static unsigned position(struct node *k)
+{
+	unsigned t = root, pos = 0;
+	int c;
+
+	while (t) {
+		c = cmp(k, &nodes[t]);
+		if (c < 0) {
+			t = nodes[t].left;
+		} else {
+			pos += nodes[nodes[t].left].size + 1;
+			if (c == 0)
+				return pos;
+			t = nodes[t].right;
+		}
+	}
+
+	return 0;
+}
+
+static unsigned find(const char *name)
+{
+	unsigned n;
+
+	if (!nbuckets)
+		return 0;
+
+	n = buckets[hash(name) & (nbuckets - 1)];
+	while (n && strcmp(nodes[n].name, name) != 0)
+		n = nodes[n].hnext;
+
+	return n;
+}
+
+static void mark_dirty(unsigned n)
+{
+	if (!nodes[n].is_dirty) {
+		nodes[n].is_dirty = 1;
+		nodes[n].dirtynext = dirty;
+		dirty = n;
+	}
+}
+
+static int rehash(unsigned size)
+{
+	unsigned *tmp, n, b;
+
+	if (!(tmp = calloc(size, sizeof(*tmp))))
+		return 0;
+
+	free(buckets);
+	buckets = tmp;
+	nbuckets = size;
+
+	for (n = 1; n < nnodes; n++) {
+		b = hash(nodes[n].name) & (nbuckets - 1);
+		nodes[n].hnext = buckets[b];
+		buckets[b] = n;
+	}
+
+	return 1;
+}
+
+/* Return index of the new node, or 0 if memory is exhausted */
+static unsigned new_node(const char *name, int elo, time_t lastseen, unsigned published)
+{
+	struct node *tmp;
+	unsigned n, b;
+
+	/* Node 0 is the empty tree, and has a size of zero */
+	if (!nnodes) {
+		if (!(nodes = calloc(1024, sizeof(*nodes))))
+			return 0;
+		maxnodes = 1024;
+		nnodes = 1;
+	}
+
+	if (nnodes == maxnodes) {
+		if (!(tmp = realloc(nodes, 2 * maxnodes * sizeof(*nodes))))
+			return 0;
+		nodes = tmp;
+		maxnodes *= 2;
+	}
+
+	if (nnodes >= nbuckets && !rehash(nbuckets ? 2 * nbuckets : 1024))
+		return 0;
+
+	n = nnodes++;
+	memset(&nodes[n], 0, sizeof(nodes[n]));
+	snprintf(nodes[n].name, sizeof(nodes[n].name), "%s", name);
+	nodes[n].elo = elo;
+	nodes[n].lastseen = lastseen;
+	nodes[n].published = published;
+	nodes[n].prio = random_priority();
+
+	b = hash(nodes[n].name) & (nbuckets - 1);
+	nodes[n].hnext = buckets[b];
+	buckets[b] = n;
+
+	insert(n);
+	return n;
+}
+
+struct rank_row {
+	char name[NAME_LENGTH];
+	int elo;
+	time_t lastseen;
+	unsigned rank;
+};
+
+static void read_rank_row(sqlite3_stmt *res, void *_r)
+{
+	struct rank_row *r = _r;
+	snprintf(r->name, sizeof(r->name), "%s", sqlite3_column_text(res, 0));
+	r->elo = sqlite3_column_int(res, 1);
+	r->lastseen = sqlite3_column_int64(res, 2);
+	r->rank = sqlite3_column_int64(res, 3);
+}
+
+int load_rank_tree(void)
+{
+	unsigned nrow, n;
+	sqlite3_stmt *res;
+	struct rank_row r;
+	int failed = 0;
+
+	const char *query =
+		"SELECT name, elo, lastseen, rank"
+		" FROM players"
+		" ORDER BY" SORT_BY_ELO;
+
+	unload();
+
+	foreach_row(query, read_rank_row, &r) {
+		if (!(n = new_node(r.name, r.elo, r.lastseen, r.rank))) {
+			fprintf(stderr, "load_rank_tree(): Out of memory\n");
+			failed = 1;
+			break_foreach;
+		}
+		if (r.rank != nrow + 1)
+			mark_dirty(n);
+	}
+
+	if (!res || failed) {
+		unload();
+		return 0;
+	}
+
+	loaded = 1;
+	return 1;
+}
+
+int is_rank_tree_loaded(void)
+{
+	return loaded;
+}
+
+void unload_rank_tree(void)
+{
+	unload();
+}
+
+void rank_tree_insert(const char *name, int elo, time_t lastseen)
+{
+	unsigned n;
+
+	if (!loaded)
+		return;
+
+	if (find(name)) {
+		rank_tree_set_elo(name, elo);
+		rank_tree_set_lastseen(name, lastseen);
+		return;
+	}
+
+	/*
+	 * Without the player in the tree, ranks would be wrong.  Drop
+	 * the tree so that it get loaded again later.
+	 */
+	if (!(n = new_node(name, elo, lastseen, 0))) {
+		fprintf(stderr, "rank_tree_insert(): Out of memory\n");
+		unload();
+		return;
+	}
+
+	mark_dirty(n);
+}
+
+void rank_tree_set_elo(const char *name, int elo)
+{
+	unsigned n;
+
+	if (!loaded || !(n = find(name)) || nodes[n].elo == elo)
+		return;
+
+	root = erase(root, &nodes[n]);
+	nodes[n].elo = elo;
+	insert(n);
+	mark_dirty(n);
+}
+
+void rank_tree_set_lastseen(const char *name, time_t lastseen)
+{
+	unsigned n;
+
+	if (!loaded || !(n = find(name)) || nodes[n].lastseen == lastseen)
+		return;
+
+	root = erase(root, &nodes[n]);
+	nodes[n].lastseen = lastseen;
+	insert(n);
+	mark_dirty(n);
+}
+
+unsigned rank_tree_lookup(const char *name)
+{
+	unsigned n;
+
+	if (!loaded || !(n = find(name)))
+		return 0;
+
+	return position(&nodes[n]);
+}
+
+unsigned rank_tree_size(void)
+{
+	return loaded ? nodes[root].size : 0;
+}
+
+/*
+ * A player whose rank moved from A to B can only change ranks between A
+ * and B.  A new player landing at rank A shift every players ranked
+ * from A to the last one.  Ranks outside of those ranges cannot have
+ * changed, because the exact same number of players are above them.
+ */
+struct range {
+	unsigned lo, hi;
+};
+
+static int cmp_range(const void *_a, const void *_b)
+{
+	const struct range *a = _a, *b = _b;
+
+	if (a->lo != b->lo)
+		return a->lo < b->lo ? -1 : 1;
+	return 0;
+}
+
+/*
+ * Write ranks of every nodes ranked between lo and hi.  Nodes whose
+ * rank could not be written are marked dirty again, to be retried by
+ * the next call to publish_ranks().
+ */
+static unsigned publish_range(unsigned t, unsigned before, unsigned lo, unsigned hi)
+{
+	unsigned pos, changed = 0;
+
+	if (!t)
+		return 0;
+
+	pos = before + nodes[nodes[t].left].size + 1;
+
+	if (lo < pos)
+		changed += publish_range(nodes[t].left, before, lo, hi);
+
+	if (lo <= pos && pos <= hi && nodes[t].published != pos) {
+		if (exec("UPDATE players SET rank = ? WHERE name = ?",
+		         "us", pos, nodes[t].name)) {
+			nodes[t].published = pos;
+			changed++;
+		} else {
+			mark_dirty(t);
+		}
+	}
+
+	if (hi > pos)
+		changed += publish_range(nodes[t].right, pos, lo, hi);
+
+	return changed;
+}
+
+unsigned publish_ranks(void)
+{
+	struct range *ranges = NULL, *tmp;
+	unsigned nranges = 0, maxranges = 0;
+	unsigned n, i, j, pos, changed = 0;
+
+	if (!loaded)
+		return 0;
+
+	for (n = dirty; n; n = nodes[n].dirtynext) {
+		if (nranges == maxranges) {
+			maxranges = maxranges ? 2 * maxranges : 1024;
+			if (!(tmp = realloc(ranges, maxranges * sizeof(*ranges)))) {
+				fprintf(stderr, "publish_ranks(): Out of memory\n");
+				free(ranges);
+				unload();
+				return 0;
+			}
+			ranges = tmp;
+		}
+
+		pos = position(&nodes[n]);
+		if (!nodes[n].published) {
+			ranges[nranges].lo = pos;
+			ranges[nranges].hi = nnodes - 1;
+		} else if (nodes[n].published < pos) {
+			ranges[nranges].lo = nodes[n].published;
+			ranges[nranges].hi = pos;
+		} else {
+			ranges[nranges].lo = pos;
+			ranges[nranges].hi = nodes[n].published;
+		}
+		nranges++;
+	}
+
+	if (!nranges)
+		return 0;
+
+	qsort(ranges, nranges, sizeof(*ranges), cmp_range);
+
+	/* Merge overlapping ranges so that ranks are written only once */
+	for (i = 0, j = 1; j < nranges; j++) {
+		if (ranges[j].lo <= ranges[i].hi + 1) {
+			if (ranges[j].hi > ranges[i].hi)
+				ranges[i].hi = ranges[j].hi;
+		} else {
+			ranges[++i] = ranges[j];
+		}
+	}
+	nranges = i + 1;
+
+	/* Ranges are known now, nodes failing below will be dirty again */
+	for (n = dirty; n; n = nodes[n].dirtynext)
+		nodes[n].is_dirty = 0;
+	dirty = 0;
+
+	for (i = 0; i < nranges; i++)
+		changed += publish_range(root, 0, ranges[i].lo, ranges[i].hi);
+
+	free(ranges);
+	return changed;
+}
@@ -0,0 +1,54 @@
+#ifndef RANKTREE_H
+#define RANKTREE_H
+
+#include <time.h>
+
+/*
+ * Keep every players in memory, ordered the same way SORT_BY_ELO does.
+ * Each node knows the size of its subtree, hence the rank of any
+ * player can be found in O(log n), and moving a player when its elo or
+ * lastseen date change is O(log n) as well.
+ *
+ * The tree also remember the rank last written in the database for
+ * each player, so that publish_ranks() only write ranks that did
+ * actually change.
+ */
+
+/*
+ * Load every players from the database.  Ranks stored in the database
+ * must be consistent with elo scores, so this should be called right
+ * after recompute_ranks().  Return 0 on failure.
+ */
+int load_rank_tree(void);
+
+/* Return non-zero when load_rank_tree() did succeed */
+int is_rank_tree_loaded(void);
+
+/*
+ * Forget the tree, when the database rolled back changes it did track.
+ * The next ranks update will then recompute and load it again.
+ */
+void unload_rank_tree(void);
+
+/*
+ * Functions below keep the tree in sync with the database.  They do
+ * nothing when the tree isn't loaded yet, since loading the tree will
+ * read the database anyway.
+ */
+void rank_tree_insert(const char *name, int elo, time_t lastseen);
+void rank_tree_set_elo(const char *name, int elo);
+void rank_tree_set_lastseen(const char *name, time_t lastseen);
+
+/* Current rank of the given player, or 0 if it is unknown */
+unsigned rank_tree_lookup(const char *name);
+
+/* Number of players in the tree, hence ranked once ranks are published */
+unsigned rank_tree_size(void);
+
+/*
+ * Write in the database ranks of every players whose rank changed
+ * since the last call.  Return the number of ranks written.
+ */
+unsigned publish_ranks(void);
+
+#endif /* RANKTREE_H */
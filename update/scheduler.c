@@ -1,55 +1,170 @@
-#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <poll.h>
+#include <limits.h>
+#include <math.h>
 
 #include "scheduler.h"
 
-static struct job *jobs;
+static struct job **heap;
+static unsigned njobs, maxjobs;
 
-static int is_before(struct job *job, time_t date)
+static void place(struct job *job, unsigned i)
 {
-	return job && job->date < date;
+	heap[i] = job;
+	job->index = i + 1;
 }
 
-void schedule(struct job *job, time_t date)
+static void sift_up(unsigned i)
+{
+	struct job *job = heap[i];
+	unsigned parent;
+
+	while (i > 0) {
+		parent = (i - 1) / 2;
+		if (heap[parent]->date <= job->date)
+			break;
+		place(heap[parent], i);
+		i = parent;
+	}
+
+	place(job, i);
+}
+
+static void sift_down(unsigned i)
+{
+	struct job *job = heap[i];
+	unsigned child;
+
+	while ((child = 2 * i + 1) < njobs) {
+		if (child + 1 < njobs && heap[child + 1]->date < heap[child]->date)
+			child++;
+		if (job->date <= heap[child]->date)
+			break;
+		place(heap[child], i);
+		i = child;
+	}
+
+	place(job, i);
+}
+
+static int grow(void)
+{
+	struct job **tmp;
+	unsigned size;
+
+	size = maxjobs ? 2 * maxjobs : 1024;
+	if (!(tmp = realloc(heap, size * sizeof(*heap))))
+		return 0;
+
+	heap = tmp;
+	maxjobs = size;
+	return 1;
+}
+
+double scheduler_clock(void)
 {
-	struct job **pp = &jobs;
+	struct timespec ts;
 
-	while (is_before(*pp, date))
-		pp = &(*pp)->next;
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) == -1)
+		return 0;
+
+	return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+static void schedule_at(struct job *job, double date)
+{
+	/* Already scheduled: move it to its new place */
+	if (job->index) {
+		job->date = date;
+		sift_up(job->index - 1);
+		sift_down(job->index - 1);
+		return;
+	}
+
+	if (njobs == maxjobs && !grow()) {
+		fprintf(stderr, "schedule(): Out of memory, job dropped\n");
+		return;
+	}
 
 	job->date = date;
-	job->next = *pp;
-	*pp = job;
+	heap[njobs] = job;
+	sift_up(njobs++);
+}
+
+/* Calendar dates are converted once, with their sub-second offset */
+void schedule(struct job *job, time_t date)
+{
+	struct timespec ts;
+	double ms;
+
+	if (!date || clock_gettime(CLOCK_REALTIME, &ts) == -1) {
+		schedule_at(job, 0);
+		return;
+	}
+
+	ms = (date - ts.tv_sec) * 1000.0 - ts.tv_nsec / 1e6;
+	schedule_at(job, scheduler_clock() + ms);
 }
 
-static time_t waiting_time(void)
+void schedule_in(struct job *job, double ms)
 {
-	time_t now = time(NULL);
+	schedule_at(job, scheduler_clock() + ms);
+}
 
-	if (!jobs || now > jobs->date)
+static double waiting_time(void)
+{
+	double now = scheduler_clock();
+
+	if (!njobs || now >= heap[0]->date)
 		return 0;
 	else
-		return jobs->date - now;
+		return heap[0]->date - now;
 }
 
 struct job *next_schedule(void)
 {
 	struct job *job;
 
-	if (waiting_time() || !jobs)
+	if (!njobs || waiting_time())
 		return NULL;
 
-	job = jobs;
-	jobs = jobs->next;
+	job = heap[0];
+	job->index = 0;
+
+	if (--njobs) {
+		heap[0] = heap[njobs];
+		sift_down(0);
+	}
 
 	return job;
 }
 
+/* Round up, otherwise we would wake up just before the job is due */
+int schedule_timeout(void)
+{
+	double ms;
+
+	if (!njobs)
+		return -1;
+
+	ms = ceil(waiting_time());
+	return ms > INT_MAX ? INT_MAX : ms;
+}
+
+/*
+ * poll() with no file descriptors is a sleep with a millisecond
+ * resolution, and it returns early when a signal is received.
+ */
 void wait_until_next_schedule(void)
 {
-	sleep(waiting_time());
+	int timeout;
+
+	if ((timeout = schedule_timeout()) > 0)
+		poll(NULL, 0, timeout);
 }
 
 int have_schedule(void)
 {
-	return jobs != NULL;
+	return njobs != 0;
 }
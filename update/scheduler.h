@@ -3,15 +3,42 @@
 
 #include <time.h>
 
-struct job;
+/*
+ * Jobs are kept in a binary heap ordered by date.  "index" is the
+ * position of the job in the heap plus one, zero when not scheduled,
+ * so that a job can be rescheduled while being already scheduled.
+ *
+ * Dates are in milliseconds on the monotonic clock, see
+ * scheduler_clock(), so that jobs due in 10ms don't wait for the next
+ * whole second and changing the system time doesn't delay them.  Date 0
+ * means as soon as possible.
+ */
 struct job {
-	time_t date;
-	struct job *next;
+	double date;
+	unsigned index;
 };
 
+/* Current date, in milliseconds, on the clock used for job dates */
+double scheduler_clock(void);
+
+/*
+ * Schedule the job at the given calendar date, as stored in the
+ * database.  Zero means as soon as possible.
+ */
 void schedule(struct job *job, time_t date);
+
+/* Schedule the job in the given number of milliseconds */
+void schedule_in(struct job *job, double ms);
+
 struct job *next_schedule(void);
 void wait_until_next_schedule(void);
 int have_schedule(void);
 
+/*
+ * Milliseconds until the next job should run, zero if it is already
+ * late, and -1 if there are no jobs at all.  Used to not block longer
+ * than needed when waiting for something else.
+ */
+int schedule_timeout(void);
+
 #endif /* SCHEDULER_H */
@@ -3,6 +3,7 @@
 #include <assert.h>
 #include <string.h>
 #include <errno.h>
+#include <limits.h>
 
 #include "unpacker.h"
 
@@ -13,78 +14,59 @@ static const uint8_t MSG_LIST[] = {
 	255, 255, 255, 255, 'l', 'i', 's', '2'
 };
 
-struct unpacker {
-	struct packet *packet;
-	size_t offset;
+/*
+ * A packet is a list of NUL terminated fields.  They are all indexed
+ * at once with memchr(), so that the packet can be validated before
+ * anything is written, and then fields are read in place.
+ */
+struct field {
+	const char *str;
+	size_t len;
 };
 
-static void init_unpacker(struct unpacker *up, struct packet *packet)
-{
-	assert(up != NULL);
-	assert(packet != NULL);
-
-	up->packet = packet;
-	up->offset = 0;
-}
+/* Server info fields, then 5 fields per client */
+#define MAX_FIELDS (10 + 5 * MAX_CLIENTS)
 
-static int can_unpack(struct unpacker *up, unsigned length)
+static int has_header(struct packet *packet, const uint8_t *header, size_t size)
 {
-	unsigned offset;
-
-	assert(up != NULL);
-	assert(length > 0);
-
-	for (offset = up->offset; offset < up->packet->size; offset++)
-		if (up->packet->buffer[offset] == 0)
-			if (--length == 0)
-				return 1;
+	assert(packet != NULL);
+	assert(header != NULL);
 
-	return 0;
+	return packet->size >= size && memcmp(packet->buffer, header, size) == 0;
 }
 
-static char *unpack(struct unpacker *up)
+/* Index at most "max" fields, the last one being NUL terminated */
+static unsigned index_fields(
+	const uint8_t *buf, size_t size, struct field *fields, unsigned max)
 {
-	size_t old_offset;
-
-	assert(up != NULL);
-
-	old_offset = up->offset;
-	while (up->offset < up->packet->size
-	       && up->packet->buffer[up->offset] != 0)
-		up->offset++;
-
-	/* Skip the remaining 0 */
-	up->offset++;
-
-	/* can_unpack() should have been used */
-	assert(up->offset <= up->packet->size);
+	const uint8_t *end = buf + size, *nul;
+	unsigned n = 0;
+
+	while (n < max && (nul = memchr(buf, 0, end - buf))) {
+		fields[n].str = (const char*)buf;
+		fields[n].len = nul - buf;
+		buf = nul + 1;
+		n++;
+	}
 
-	return (char*)&up->packet->buffer[old_offset];
+	return n;
 }
 
-static void skip_field(struct unpacker *up)
+/* Same as snprintf("%s"), but we already know the length */
+static void unpack_string(struct field *field, char *buf, size_t size)
 {
-	unpack(up);
-}
+	size_t len = field->len < size ? field->len : size - 1;
 
-/*
- * It's a shame POSIX do not have a good enough function to copy strings
- * with bound check.  strncat() have its own caveat so we end up using
- * this suboptimal snprintf() trick.
- */
-static void unpack_string(struct unpacker *up, char *buf, size_t size)
-{
-	snprintf(buf, size, "%s", unpack(up));
+	memcpy(buf, field->str, len);
+	buf[len] = '\0';
 }
 
-static long int unpack_int(struct unpacker *up)
+static long int unpack_int_slow(struct field *field)
 {
 	long ret;
-	char *str, *endptr;
+	char *endptr;
+	const char *str = field->str;
 
-	assert(up != NULL);
-
-	str = unpack(up);
 	errno = 0;
 	ret = strtol(str, &endptr, 10);
 
@@ -97,67 +79,86 @@ static long int unpack_int(struct unpacker *up)
 	return ret;
 }
 
-int unpack_server_info(struct packet *packet, struct server *sv)
+/*
+ * Fields are almost always a few digits, maybe with a minus sign.
+ * Anything else goes through strtol(), so that results are the same.
+ */
+static long int unpack_int(struct field *field)
 {
-	struct unpacker up;
-	unsigned i;
+	const char *str = field->str;
+	size_t len = field->len;
+	long ret = 0;
+	int neg = 0;
+
+	if (len && *str == '-') {
+		neg = 1;
+		str++;
+		len--;
+	}
 
-	/*
-	 * Keep old data so that we an restore them in case of
-	 * failure.
-	 */
-	struct server old;
+	/* At most 9 digits can't overflow */
+	if (len == 0 || len > 9)
+		return unpack_int_slow(field);
+
+	for (; len; str++, len--) {
+		if (*str < '0' || *str > '9')
+			return unpack_int_slow(field);
+		ret = ret * 10 + (*str - '0');
+	}
+
+	return neg ? -ret : ret;
+}
+
+int unpack_server_info(struct packet *packet, struct server *sv)
+{
+	struct field fields[MAX_FIELDS], *f;
+	int num_clients, max_clients;
+	unsigned nfields, i;
 
 	assert(packet != NULL);
 	assert(sv != NULL);
 
-	if (!skip_header(packet, MSG_INFO, sizeof(MSG_INFO)))
+	if (!has_header(packet, MSG_INFO, sizeof(MSG_INFO)))
 		return 0;
 
-	init_unpacker(&up, packet);
-	old = *sv;
-
-	if (!can_unpack(&up, 10))
-		goto fail;
-
-	skip_field(&up); /* Token */
-	skip_field(&up); /* Version */
-	unpack_string(&up, sv->name,     sizeof(sv->name));     /* Name */
-	unpack_string(&up, sv->map,      sizeof(sv->map));      /* Map */
-	unpack_string(&up, sv->gametype, sizeof(sv->gametype)); /* Gametype */
-
-	skip_field(&up); /* Flags */
-	skip_field(&up); /* Player number */
-	skip_field(&up); /* Player max number */
-	sv->num_clients = unpack_int(&up); /* Client number */
-	sv->max_clients = unpack_int(&up); /* Client max number */
-
-	if (sv->num_clients > MAX_CLIENTS)
-		goto fail;
-	if (sv->max_clients > MAX_CLIENTS)
-		goto fail;
-	if (sv->num_clients > sv->max_clients)
-		goto fail;
-
-	/* Clients */
-	for (i = 0; i < sv->num_clients; i++) {
-		struct client *cl = &sv->clients[i];
+	nfields = index_fields(
+		packet->buffer + sizeof(MSG_INFO), packet->size - sizeof(MSG_INFO),
+		fields, MAX_FIELDS);
 
-		if (!can_unpack(&up, 5))
-			goto fail;
+	if (nfields < 10)
+		return 0;
+
+	num_clients = unpack_int(&fields[8]); /* Client number */
+	max_clients = unpack_int(&fields[9]); /* Client max number */
+
+	if (num_clients < 0 || num_clients > MAX_CLIENTS)
+		return 0;
+	if (max_clients > MAX_CLIENTS)
+		return 0;
+	if (num_clients > max_clients)
+		return 0;
+	if (nfields < 10 + 5 * num_clients)
+		return 0;
 
-		unpack_string(&up, cl->name, sizeof(cl->name)); /* Name */
-		unpack_string(&up, cl->clan, sizeof(cl->clan)); /* Clan */
+	/* Token, version, flags and player numbers are skipped */
+	unpack_string(&fields[2], sv->name,     sizeof(sv->name));     /* Name */
+	unpack_string(&fields[3], sv->map,      sizeof(sv->map));      /* Map */
+	unpack_string(&fields[4], sv->gametype, sizeof(sv->gametype)); /* Gametype */
+	sv->num_clients = num_clients;
+	sv->max_clients = max_clients;
 
-		skip_field(&up); /* Country */
-		cl->score  = unpack_int(&up); /* Score */
-		cl->ingame = unpack_int(&up); /* Ingame? */
+	/* Clients, country is skipped */
+	for (i = 0; i < num_clients; i++) {
+		struct client *cl = &sv->clients[i];
+
+		f = &fields[10 + 5 * i];
+		unpack_string(&f[0], cl->name, sizeof(cl->name)); /* Name */
+		unpack_string(&f[1], cl->clan, sizeof(cl->clan)); /* Clan */
+		cl->score  = unpack_int(&f[3]); /* Score */
+		cl->ingame = unpack_int(&f[4]); /* Ingame? */
 	}
 
 	return 1;
-fail:
-	*sv = old;
-	return 0;
 }
 
 struct server_addr_raw {
@@ -228,11 +229,11 @@ int unpack_server_addr(struct packet *packet, char **ip, char **port, int *reset
 	assert(reset_context != NULL);
 
 	if (*reset_context) {
-		if (!skip_header(packet, MSG_LIST, sizeof(MSG_LIST)))
+		if (!has_header(packet, MSG_LIST, sizeof(MSG_LIST)))
 			return 0;
 
-		size = packet->size;
-		buf = packet->buffer;
+		size = packet->size - sizeof(MSG_LIST);
+		buf = packet->buffer + sizeof(MSG_LIST);
 		*reset_context = 0;
 	}
 
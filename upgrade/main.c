@@ -197,8 +197,41 @@ static void upgrade_servers(void)
 	closedir(dir);
 }
 
+/*
+ * An existing database comes from teerank 4.x or later, it is upgraded
+ * in place.  Return zero when there is no such database, so that the
+ * files of teerank 3.x are imported instead.
+ */
+static int upgrade_database_in_place(void)
+{
+	int version;
+
+	if (access(config.dbpath, F_OK) == -1)
+		return 0;
+
+	if (!init_database(0))
+		exit(EXIT_FAILURE);
+
+	version = database_version();
+	if (version >= DATABASE_VERSION) {
+		printf("Database is up to date\n");
+		exit(EXIT_SUCCESS);
+	}
+
+	printf("Upgrading from %d to %u\n", version, DATABASE_VERSION);
+
+	if (!upgrade_database())
+		exit(EXIT_FAILURE);
+
+	printf("Success\n");
+	exit(EXIT_SUCCESS);
+}
+
 int main(int argc, char *argv[])
 {
+	load_config();
+	upgrade_database_in_place();
+
 	/* Teerank 3.x use $TEERANK_ROOT to locate database */
 	setenv("TEERANK_ROOT", ".teerank", 0);
 
@@ -221,7 +254,7 @@ int main(int argc, char *argv[])
 		}
 	}
 
-	printf("Upgrading from %u to %u\n", DATABASE_VERSION - 1, DATABASE_VERSION);
+	printf("Upgrading from %u to %u\n", 6, DATABASE_VERSION);
 
 	drop_all_indices();
 	exec("BEGIN");